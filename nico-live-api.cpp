@@ -1,12 +1,19 @@
 #include <string>
 #include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <sstream>
-#include <iomanip>
-#include <ios>
-#include <regex>
 #include <ctime>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include "nico-live-api.hpp"
-#include "curl/curl.h"
+#include "nico-live-curl-transport.hpp"
+#include "nico-live-record-transport.hpp"
+#include "nico-live-replay-transport.hpp"
 #include "pugixml.hpp"
 #include "nicolive.h"
 
@@ -18,18 +25,37 @@ const std::string NicoLiveApi::LOGIN_API_URL =
 const std::string NicoLiveApi::PUBSTAT_URL =
 	"http://live.nicovideo.jp/api/getpublishstatus";
 
+static void appendUrlEncoded(std::string *encoded, const std::string &str)
+{
+	static const char hexDigits[] = "0123456789ABCDEF";
+	for (const char &ch: str) {
+		unsigned char byte = static_cast<unsigned char>(ch);
+		switch (byte) {
+		case '&':
+		case '=':
+		case '+':
+		case '%':
+			break;
+		case ' ':
+			*encoded += '+';
+			continue;
+		default:
+			if (0x20 < byte && byte < 0x7F) {
+				*encoded += ch;
+				continue;
+			}
+		}
+		*encoded += '%';
+		*encoded += hexDigits[byte >> 4];
+		*encoded += hexDigits[byte & 0x0F];
+	}
+}
+
 std::string NicoLiveApi::createWwwFormUrlencoded(
 	const std::unordered_map<std::string, std::string> &formData)
 {
 	std::string encodedData;
-	for (auto &data: formData) {
-		if (!encodedData.empty()) {
-			encodedData += "&";
-		}
-		encodedData += NicoLiveApi::urlEncode(data.first);
-		encodedData += "=";
-		encodedData += NicoLiveApi::urlEncode(data.second);
-	}
+	NicoLiveApi::appendWwwFormUrlencoded(formData, &encodedData);
 	return encodedData;
 }
 
@@ -37,36 +63,91 @@ std::string NicoLiveApi::createCookieString(
 	const std::unordered_map<std::string, std::string> &cookie)
 {
 	std::string cookieStr;
+	NicoLiveApi::appendCookieString(cookie, &cookieStr);
+	return cookieStr;
+}
+
+void NicoLiveApi::appendWwwFormUrlencoded(
+	const std::unordered_map<std::string, std::string> &formData,
+	std::string *out)
+{
+	size_t length = out->size();
+	for (auto &data: formData) {
+		length += (data.first.size() + data.second.size()) * 3 + 2;
+	}
+	out->reserve(length);
+	bool first = true;
+	for (auto &data: formData) {
+		if (!first) {
+			*out += '&';
+		}
+		first = false;
+		appendUrlEncoded(out, data.first);
+		*out += '=';
+		appendUrlEncoded(out, data.second);
+	}
+}
+
+void NicoLiveApi::appendCookieString(
+	const std::unordered_map<std::string, std::string> &cookie,
+	std::string *out)
+{
+	size_t length = out->size();
 	for (auto &data: cookie) {
-		if (!cookieStr.empty()) {
-			cookieStr += "; ";
+		length += data.first.size() + data.second.size() + 3;
+	}
+	out->reserve(length);
+	bool first = true;
+	for (auto &data: cookie) {
+		if (!first) {
+			*out += "; ";
 		}
-		cookieStr += data.first;
-		cookieStr += "=";
-		cookieStr += data.second;
+		first = false;
+		*out += data.first;
+		*out += '=';
+		*out += data.second;
 	}
-	return cookieStr;
 }
 
+// Compiled XPath queries. parseXml is called with the same few sets, and
+// compiling a query costs more than evaluating it on a small document.
+static std::mutex xpathMutex;
+static std::unordered_map<std::string, std::unique_ptr<pugi::xpath_query>>
+	xpathCache;
+
 bool NicoLiveApi::parseXml(
 	const std::string &xml,
-	std::unordered_map<std::string, std::vector<std::string>> *data)
+	std::unordered_map<std::string, std::vector<std::string>> *data,
+	bool allowUnclosed)
 {
 	pugi::xml_document doc;
-	pugi::xml_parse_result result = doc.load_string(xml.c_str());
-	if (result.status != pugi::status_ok) {
+	pugi::xml_parse_result result = doc.load_buffer(xml.data(),
+		xml.size());
+	// a truncated document is parsed until its end
+	if (result.status != pugi::status_ok && !(allowUnclosed &&
+			result.status == pugi::status_end_element_mismatch)) {
 		return false;
 	}
+	std::lock_guard<std::mutex> lock(xpathMutex);
+	if (xpathCache.size() > NicoLiveApi::MAX_XPATH_CACHE_ENTRIES) {
+		xpathCache.clear();
+	}
 	for (auto &entry: *data) {
-		pugi::xpath_node_set nodes =
-			doc.select_nodes(entry.first.c_str());
+		std::unique_ptr<pugi::xpath_query> &query =
+			xpathCache[entry.first];
+		if (!query) {
+			query.reset(new pugi::xpath_query(
+				entry.first.c_str()));
+		}
+		pugi::xpath_node_set nodes = query->evaluate_node_set(doc);
+		entry.second.reserve(entry.second.size() + nodes.size());
 		for (auto &node: nodes) {
 			if (node.node() != nullptr) {
-				entry.second.push_back(std::string(
-					node.node().text().get()));
+				entry.second.emplace_back(
+					node.node().text().get());
 			} else {
-				entry.second.push_back(std::string(
-					node.attribute().value()));
+				entry.second.emplace_back(
+					node.attribute().value());
 			}
 		}
 	}
@@ -75,53 +156,201 @@ bool NicoLiveApi::parseXml(
 
 std::string NicoLiveApi::urlEncode(const std::string &str)
 {
-	std::stringstream stream;
-	for (const char &ch: str) {
-		if (0x20 <= ch && ch <= 0x7F) {
-			switch (ch) {
-			case '&':
-			case '=':
-			case '+':
-			case '%':
-				stream << '%';
-				stream << std::setfill ('0')
-					<< std::setw(2)
-					<< std::hex
-					<< std::uppercase
-					<< static_cast<int>(ch);
-				break;
-			case ' ':
-				stream << '+';
-				break;
-			default:
-				stream << ch;
-			}
-		} else {
-			stream << '%';
-			stream << std::setfill ('0')
-				<< std::setw(2)
-				<< std::hex
-				<< std::uppercase
-				<< static_cast<int>(ch);
-			break;
+	std::string encoded;
+	encoded.reserve(str.size() * 3);
+	appendUrlEncoded(&encoded, str);
+	return encoded;
+}
+
+bool NicoLiveApi::headerValue(const char *line, size_t length,
+	const char *name, size_t *begin, size_t *end)
+{
+	size_t nameLength = std::strlen(name);
+	if (length <= nameLength || line[nameLength] != ':') {
+		return false;
+	}
+	for (size_t i = 0; i < nameLength; i++) {
+		if (std::tolower(static_cast<unsigned char>(line[i])) !=
+				std::tolower(static_cast<unsigned char>(
+					name[i]))) {
+			return false;
 		}
 	}
-	return stream.str();
+	size_t first = nameLength + 1;
+	while (first < length && (line[first] == ' ' || line[first] == '\t')) {
+		first++;
+	}
+	size_t last = length;
+	while (last > first && std::isspace(
+			static_cast<unsigned char>(line[last - 1]))) {
+		last--;
+	}
+	*begin = first;
+	*end = last;
+	return true;
 }
 
-size_t NicoLiveApi::writeString(char *ptr, size_t size, size_t nmemb,
-	void *userdata)
+bool NicoLiveApi::headerValue(const char *line, size_t length,
+	const char *name, std::string *value)
 {
-	size_t length = size * nmemb;
-	std::string *str = static_cast<std::string *>(userdata);
-	str->append(ptr, length);
-	return length;
-};
+	size_t begin;
+	size_t end;
+	if (!headerValue(line, length, name, &begin, &end)) {
+		return false;
+	}
+	value->assign(line + begin, end - begin);
+	return true;
+}
+
+static bool startsWithLower(const char *str, size_t length,
+	const char *prefix)
+{
+	size_t prefixLength = std::strlen(prefix);
+	if (length < prefixLength) {
+		return false;
+	}
+	for (size_t i = 0; i < prefixLength; i++) {
+		if (std::tolower(static_cast<unsigned char>(str[i])) !=
+				prefix[i]) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// directives of the header value [value, value + length)
+static void parseCacheControl(const char *value, size_t length,
+	bool *storable, long long *maxAge)
+{
+	const char *end = value + length;
+	while (value < end) {
+		const char *comma = static_cast<const char *>(
+			std::memchr(value, ',', end - value));
+		const char *next = comma == nullptr ? end : comma;
+		while (value < next && (*value == ' ' || *value == '\t')) {
+			value++;
+		}
+		size_t directiveLength = next - value;
+		if (startsWithLower(value, directiveLength, "no-store")) {
+			*storable = false;
+		} else if (startsWithLower(value, directiveLength,
+				"no-cache")) {
+			*maxAge = 0;
+		} else if (startsWithLower(value, directiveLength,
+				"max-age=")) {
+			// stops at the comma or the end of the line
+			*maxAge = std::atoll(value + 8);
+		}
+		value = comma == nullptr ? end : comma + 1;
+	}
+}
+
+// "https://host/path?query" -> baseUrl + "/path?query"
+std::string NicoLiveApi::replaceBaseUrl(const std::string &url,
+	const std::string &baseUrl)
+{
+	if (baseUrl.empty()) {
+		return url;
+	}
+	size_t pathBegin = url.find("://");
+	pathBegin = pathBegin == std::string::npos ?
+		0 : url.find('/', pathBegin + 3);
+	std::string base = baseUrl;
+	while (!base.empty() && base.back() == '/') {
+		base.pop_back();
+	}
+	if (pathBegin == std::string::npos) {
+		return base;
+	}
+	return base + url.substr(pathBegin);
+}
+
+// FNV-1a 64bit
+uint64_t NicoLiveApi::hashString(uint64_t hash, const char *str,
+	size_t length)
+{
+	for (size_t i = 0; i < length; i++) {
+		hash ^= static_cast<unsigned char>(str[i]);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
 
 // instance
-NicoLiveApi::NicoLiveApi() {}
+NicoLiveApi::NicoLiveApi() :
+	transport(new NicoLiveCurlTransport()), canceled(false)
+{
+}
+
+NicoLiveApi::~NicoLiveApi()
+{
+}
+
+void NicoLiveApi::setTransport(NicoLiveTransport *transport)
+{
+	this->transport.reset(transport);
+}
 
-NicoLiveApi::~NicoLiveApi() {}
+void NicoLiveApi::setTraffic(NicoLiveApi::TrafficMode mode,
+	const std::string &path)
+{
+	if (path.empty()) {
+		mode = NicoLiveApi::TrafficMode::OFF;
+	}
+	if (mode == this->trafficMode && (mode == TrafficMode::OFF ||
+			path == this->trafficPath)) {
+		return;
+	}
+	this->trafficMode = mode;
+	this->trafficPath = path;
+
+	switch (mode) {
+	case NicoLiveApi::TrafficMode::RECORD:
+		this->setTransport(new NicoLiveRecordTransport(
+			new NicoLiveCurlTransport(), path));
+		break;
+	case NicoLiveApi::TrafficMode::REPLAY:
+	case NicoLiveApi::TrafficMode::REPLAY_TIMED:
+		this->setTransport(new NicoLiveReplayTransport(path,
+			mode == NicoLiveApi::TrafficMode::REPLAY_TIMED));
+		break;
+	default:
+		this->setTransport(new NicoLiveCurlTransport());
+	}
+	// responses of the other world must not be mixed
+	this->clearCache();
+	this->resetPublishStatusHash();
+}
+
+NicoLiveApi::TrafficMode NicoLiveApi::getTrafficMode() const
+{
+	return this->trafficMode;
+}
+
+void NicoLiveApi::setBaseUrl(const std::string &baseUrl)
+{
+	std::string pubStatUrl = NicoLiveApi::replaceBaseUrl(
+		NicoLiveApi::PUBSTAT_URL, baseUrl);
+	if (pubStatUrl == this->pubStatUrl) {
+		return;
+	}
+	if (!baseUrl.empty()) {
+		nicolive_log_info("use web api at %s", baseUrl.c_str());
+	}
+	this->loginSiteUrl = NicoLiveApi::replaceBaseUrl(
+		NicoLiveApi::LOGIN_SITE_URL, baseUrl);
+	this->loginApiUrl = NicoLiveApi::replaceBaseUrl(
+		NicoLiveApi::LOGIN_API_URL, baseUrl);
+	this->pubStatUrl = pubStatUrl;
+	this->clearCache();
+	this->resetPublishStatusHash();
+}
+
+const NicoLiveApi::Metrics &NicoLiveApi::getMetrics() const
+{
+	return this->metrics;
+}
 
 void NicoLiveApi::setCookie(const std::string &name, const std::string &value)
 {
@@ -138,22 +367,241 @@ void NicoLiveApi::clearCookie()
 	this->cookie.clear();
 }
 
+void NicoLiveApi::clearCache()
+{
+	this->cache.clear();
+}
+
 const std::string NicoLiveApi::getCookie(const std::string &name) const
 {
 	return this->cookie.at(name);
 }
 
+void NicoLiveApi::beginOperation(long long budgetMsec, int requests)
+{
+	this->inOperation = true;
+	this->deadline = std::chrono::steady_clock::now() +
+		std::chrono::milliseconds(budgetMsec);
+	this->remainingRequests = std::max(requests, 1);
+}
+
+void NicoLiveApi::endOperation()
+{
+	this->inOperation = false;
+	this->remainingRequests = 0;
+}
+
+void NicoLiveApi::cancel()
+{
+	nicolive_log_debug("cancel web access");
+	this->canceled = true;
+}
+
+void NicoLiveApi::clearCancel()
+{
+	this->canceled = false;
+}
+
+bool NicoLiveApi::isCanceled() const
+{
+	return this->canceled;
+}
+
+long long NicoLiveApi::nextTimeout()
+{
+	if (!this->inOperation) {
+		return NicoLiveApi::DEFAULT_TIMEOUT_MSEC;
+	}
+
+	long long remaining =
+		std::chrono::duration_cast<std::chrono::milliseconds>(
+			this->deadline - std::chrono::steady_clock::now())
+		.count();
+	if (remaining <= 0) {
+		return 0;
+	}
+
+	// unused time of earlier requests is carried over to later ones
+	long long timeout = remaining / this->remainingRequests;
+	if (this->remainingRequests > 1) {
+		this->remainingRequests--;
+	}
+	return std::max(timeout, 1LL);
+}
+
+const char *NicoLiveApi::endpointName(NicoLiveApi::Endpoint endpoint)
+{
+	switch (endpoint) {
+	case NicoLiveApi::Endpoint::LOGIN_SITE:
+		return "login";
+	case NicoLiveApi::Endpoint::LOGIN_API:
+		return "login api";
+	case NicoLiveApi::Endpoint::PUBSTAT:
+		return "pubstat";
+	default:
+		return "other";
+	}
+}
+
+const NicoLiveApi::EndpointTimings &NicoLiveApi::getTimings(
+	NicoLiveApi::Endpoint endpoint) const
+{
+	return this->timings[static_cast<int>(endpoint)];
+}
+
+void NicoLiveApi::recordTiming(NicoLiveApi::Endpoint endpoint,
+	const NicoLiveResponse &response)
+{
+	const NicoLiveTiming &timing = response.timing;
+	// curl leaves a phase 0 when it did not happen, e.g. no TLS
+	long long connected = std::max(timing.nameLookupUsec,
+		timing.connectUsec);
+	long long secured = std::max(connected, timing.appConnectUsec);
+	long long started = std::max(secured, timing.startTransferUsec);
+	long long finished = std::max(started, timing.totalUsec);
+
+	EndpointTimings &timings = this->timings[static_cast<int>(endpoint)];
+	timings.requests++;
+	if (response.reused) {
+		timings.reused++;
+	}
+	timings.responseBytes += static_cast<long long>(
+		response.header.size() + response.body.size());
+	timings.nameLookup.add(timing.nameLookupUsec);
+	timings.connect.add(connected - timing.nameLookupUsec);
+	timings.tls.add(secured - connected);
+	timings.server.add(started - secured);
+	timings.transfer.add(finished - started);
+	timings.total.add(finished);
+
+	nicolive_log_debug("%s timing: dns %lld, connect %lld, tls %lld, "
+		"server %lld, transfer %lld us%s",
+		NicoLiveApi::endpointName(endpoint), timing.nameLookupUsec,
+		connected - timing.nameLookupUsec, secured - connected,
+		started - secured, finished - started,
+		response.reused ? " (reused)" : "");
+}
+
+void NicoLiveApi::logTimings() const
+{
+	for (int i = 0; i < static_cast<int>(NicoLiveApi::Endpoint::COUNT);
+			i++) {
+		const EndpointTimings &timings = this->timings[i];
+		if (timings.requests == 0) {
+			continue;
+		}
+		char requests[24];
+		char reused[24];
+		char p50[24];
+		char p95[24];
+		char max[24];
+		char dns[24];
+		char connect[24];
+		char tls[24];
+		char server[24];
+		char transfer[24];
+		std::snprintf(requests, sizeof(requests), "%lld",
+			timings.requests);
+		std::snprintf(reused, sizeof(reused), "%lld", timings.reused);
+		std::snprintf(p50, sizeof(p50), "%lld",
+			timings.total.percentileMsec(50));
+		std::snprintf(p95, sizeof(p95), "%lld",
+			timings.total.percentileMsec(95));
+		std::snprintf(max, sizeof(max), "%lld",
+			timings.total.maxUsec / 1000);
+		std::snprintf(dns, sizeof(dns), "%lld",
+			timings.nameLookup.meanUsec());
+		std::snprintf(connect, sizeof(connect), "%lld",
+			timings.connect.meanUsec());
+		std::snprintf(tls, sizeof(tls), "%lld",
+			timings.tls.meanUsec());
+		std::snprintf(server, sizeof(server), "%lld",
+			timings.server.meanUsec());
+		std::snprintf(transfer, sizeof(transfer), "%lld",
+			timings.transfer.meanUsec());
+		nicolive_log_fields(LOG_INFO, "timings",
+			"endpoint", NicoLiveApi::endpointName(
+				static_cast<NicoLiveApi::Endpoint>(i)),
+			"requests", requests, "reused", reused,
+			"total_p50_ms", p50, "total_p95_ms", p95,
+			"total_max_ms", max,
+			"mean_dns_us", dns, "mean_connect_us", connect,
+			"mean_tls_us", tls, "mean_server_us", server,
+			"mean_transfer_us", transfer);
+	}
+}
+
+void NicoLiveApi::setEnabledHedge(bool enabled)
+{
+	this->useHedge = enabled;
+}
+
+bool NicoLiveApi::enabledHedge() const
+{
+	return this->useHedge;
+}
+
+long long NicoLiveApi::hedgeThreshold() const
+{
+	if (this->hedgeLatencies.size() < NicoLiveApi::HEDGE_MIN_SAMPLES) {
+		return NicoLiveApi::HEDGE_DEFAULT_MSEC;
+	}
+	std::vector<long long> sorted(this->hedgeLatencies);
+	size_t index = sorted.size() * NicoLiveApi::HEDGE_PERCENTILE / 100;
+	if (index >= sorted.size()) {
+		index = sorted.size() - 1;
+	}
+	std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+	return std::max(sorted[index],
+		static_cast<long long>(NicoLiveApi::HEDGE_MIN_MSEC));
+}
+
+// The threshold is a percentile of the first request alone. When the
+// duplicate won, the first one was aborted and its latency is unknown, so
+// nothing is sampled; the elapsed time is that of the duplicate.
+void NicoLiveApi::recordHedgeLatency(long long msec, bool hedgeWon)
+{
+	this->hedgeCount++;
+	if (hedgeWon) {
+		this->hedgeWinCount++;
+	} else {
+		if (this->hedgeLatencies.size() <
+				NicoLiveApi::HEDGE_MAX_SAMPLES) {
+			this->hedgeLatencies.push_back(msec);
+		} else {
+			this->hedgeLatencies[this->hedgeNext] = msec;
+		}
+		this->hedgeNext = (this->hedgeNext + 1) %
+			NicoLiveApi::HEDGE_MAX_SAMPLES;
+	}
+	nicolive_log_debug("hedged access: %lld ms, won by %s (%d/%d)",
+		msec, hedgeWon ? "duplicate" : "first",
+		this->hedgeWinCount, this->hedgeCount);
+}
+
+// Set headers[index] to name + value, reusing the string there.
+static void setHeader(std::vector<std::string> *headers, size_t index,
+	const char *name, const std::string &value)
+{
+	if (index >= headers->size()) {
+		headers->emplace_back();
+	}
+	std::string &header = (*headers)[index];
+	header.assign(name);
+	header += value;
+}
+
 bool NicoLiveApi::accessWeb(
 	const std::string &url,
 	const NicoLiveApi::Method &method,
 	const std::unordered_map<std::string, std::string> &formData,
 	int *code,
-	std::string *response)
+	std::string *response,
+	const NicoLiveApi::AccessOptions &options)
 {
 	*code = 0;
-	bool useSsl = false;
 	if (url.find("https://") == 0) {
-		useSsl = true;
+		;
 	} else if (url.find("http://") == 0) {
 		;
 	} else {
@@ -173,100 +621,238 @@ bool NicoLiveApi::accessWeb(
 			break;
 		default:
 			nicolive_log_error("unknown method type: %d",
-				method);
+				static_cast<int>(method));
 			*code = -2;
 			*response = "unknown method";
 			return false;
 	}
 
-	std::string headerData;
-	std::string bodyData;
-
-	std::string postData;
+	// built into the buffers of the last access, not to allocate
+	NicoLiveRequest &request = this->request;
+	request.postData.clear();
 	if (hasPost) {
-		postData = NicoLiveApi::createWwwFormUrlencoded(formData);
+		NicoLiveApi::appendWwwFormUrlencoded(formData,
+			&request.postData);
 	}
+	request.cookie.clear();
+	NicoLiveApi::appendCookieString(this->cookie, &request.cookie);
+	nicolive_log_debug("create cookie: %s", request.cookie.c_str());
 
-	CURL *curl;
-	CURLcode res;
-
-	curl_global_init(CURL_GLOBAL_DEFAULT);
-
-	curl = curl_easy_init();
-
-	if (curl == nullptr) {
-		nicolive_log_error("curl init error");
-		*code = -3;
-		*response = "curl init error";
-		return false;
+	std::string &cacheKey = this->cacheKey;
+	CacheEntry *cached = nullptr;
+	if (options.cache) {
+		cacheKey.assign(hasPost ? "POST " : "GET ");
+		cacheKey += url;
+		cacheKey += '\n';
+		cacheKey += request.cookie;
+		cacheKey += '\n';
+		cacheKey += request.postData;
+		auto found = this->cache.find(cacheKey);
+		if (found != this->cache.end()) {
+			cached = &found->second;
+			if (std::chrono::steady_clock::now() < cached->expires) {
+				nicolive_log_debug("fresh cache: %s",
+					url.c_str());
+				this->metrics.cacheHits++;
+				*code = cached->code;
+				*response = cached->body;
+				this->lastBodyHash = cached->bodyHash;
+				return true;
+			}
+		}
 	}
 
-	// URL
-	curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-
-	// header and body data
-	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &headerData);
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION,
-		NicoLiveApi::writeString);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &bodyData);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION,
-		NicoLiveApi::writeString);
-
-	if (useSsl) {
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
-		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 1L);
+	if (this->isCanceled()) {
+		nicolive_log_warn("web access canceled: %s", url.c_str());
+		*code = -5;
+		*response = "canceled";
+		return false;
 	}
 
-	// Cookie
-	nicolive_log_debug("create cookie: %s",
-			NicoLiveApi::createCookieString(this->cookie).c_str());
-	if (! this->cookie.empty()) {
-		curl_easy_setopt(curl, CURLOPT_COOKIE,
-			NicoLiveApi::createCookieString(this->cookie).c_str());
+	long long timeout = this->nextTimeout();
+	if (timeout <= 0) {
+		nicolive_log_warn("deadline exceeded before access: %s",
+			url.c_str());
+		*code = -6;
+		*response = "deadline exceeded";
+		return false;
 	}
 
-	// POST data
-	if (hasPost) {
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
-			static_cast<long>(postData.size()));
-		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, postData.c_str());
+	request.url = url;
+	request.post = hasPost;
+	size_t headerCount = 0;
+	if (cached != nullptr) {
+		if (!cached->etag.empty()) {
+			setHeader(&request.headers, headerCount++,
+				"If-None-Match: ", cached->etag);
+		}
+		if (!cached->lastModified.empty()) {
+			setHeader(&request.headers, headerCount++,
+				"If-Modified-Since: ", cached->lastModified);
+		}
 	}
+	request.headers.resize(headerCount);
+	request.timeoutMsec = timeout;
+	request.hedgeMsec = options.hedge ? this->hedgeThreshold() : 0;
+	request.completeHeader = options.completeHeader;
+	request.completeBody = options.completeBody;
+	request.canceled = &this->canceled;
 
-	res = curl_easy_perform(curl);
+	auto startTime = std::chrono::steady_clock::now();
+	this->lastResponse.error.clear();
+	NicoLiveTransport::Result result = this->transport->perform(request,
+		&this->lastResponse, &this->metrics);
+	long long elapsed =
+		std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - startTime).count();
 
-	curl_easy_cleanup(curl);
-	curl_global_cleanup();
+	nicolive_log_debug("web access metrics: requests %lld, sent %lld, "
+		"received %lld, reused %lld, handshake %lld (%lld us)",
+		this->metrics.requests, this->metrics.sentBytes,
+		this->metrics.receivedBytes, this->metrics.reusedConnections,
+		this->metrics.handshakes, this->metrics.handshakeUsec);
 
-	if (res != CURLE_OK) {
-		nicolive_log_error("curl failed: %s\n",
-			curl_easy_strerror(res));
-		*code = -4;
+	switch (result) {
+	case NicoLiveTransport::Result::OK:
+		break;
+	case NicoLiveTransport::Result::INIT_ERROR:
+		*code = -3;
 		*response = "curl init error";
 		return false;
+	case NicoLiveTransport::Result::CANCELED:
+		nicolive_log_warn("web access canceled: %s", url.c_str());
+		*code = -5;
+		*response = "canceled";
+		return false;
+	case NicoLiveTransport::Result::TIMEOUT:
+		nicolive_log_error("web access timed out after %lld ms: %s",
+			timeout, url.c_str());
+		*code = -6;
+		*response = "deadline exceeded";
+		return false;
+	default:
+		*code = -4;
+		*response = "curl failed: " + this->lastResponse.error;
+		return false;
+	}
+
+	if (options.hedge) {
+		this->recordHedgeLatency(elapsed, this->lastResponse.hedgeWon);
+	}
+	if (this->lastResponse.timing.totalUsec == 0) {
+		this->lastResponse.timing.totalUsec = elapsed * 1000;
 	}
+	this->recordTiming(options.endpoint, this->lastResponse);
+	const std::string &headerData = this->lastResponse.header;
+	std::string &bodyData = this->lastResponse.body;
+	this->lastBodyHash = this->lastResponse.bodyHash;
 
 	// Get code and set cookie
-	std::istringstream isHeader(headerData);
-	std::regex httpRe("HTTP/\\d+\\.\\d+\\s+(\\d+)\\s.*\\r?",
-		std::regex_constants::icase);
-	std::regex setCookieRe("Set-Cookie:\\s+([^=]+)=([^;]+);.*\\r?",
-		std::regex_constants::icase);
-	std::smatch results;
-	for (std::string line; std::getline(isHeader, line); ) {
-		nicolive_log_debug("header: %s", line.c_str());
-		if (std::regex_match(line, results, httpRe)) {
-			nicolive_log_debug("header httpRe: %s",
-				results.str(1).c_str());
-			*code = std::stoi(results.str(1));
-		} else if (std::regex_match(line, results, setCookieRe)) {
-			nicolive_log_debug("header setCookieRe: %s, %s",
-				results.str(1).c_str(), results.str(2).c_str());
-			this->cookie[results.str(1)] = results.str(2);
+	// the validators are kept in headerData until stored in the cache
+	const char *etag = nullptr;
+	size_t etagLength = 0;
+	const char *lastModified = nullptr;
+	size_t lastModifiedLength = 0;
+	bool storable = options.cache;
+	long long maxAge = 0;
+	size_t lineBegin = 0;
+	while (lineBegin < headerData.size()) {
+		size_t lineEnd = headerData.find('\n', lineBegin);
+		if (lineEnd == std::string::npos) {
+			lineEnd = headerData.size();
+		}
+		const char *line = headerData.c_str() + lineBegin;
+		size_t lineLength = lineEnd - lineBegin;
+		lineBegin = lineEnd + 1;
+
+		size_t begin;
+		size_t end;
+		if (lineLength > 5 && std::strncmp(line, "HTTP/", 5) == 0) {
+			const char *status = static_cast<const char *>(
+				std::memchr(line, ' ', lineLength));
+			if (status != nullptr) {
+				*code = std::atoi(status + 1);
+				nicolive_log_debug("header status: %d", *code);
+			}
+		} else if (headerValue(line, lineLength, "Set-Cookie",
+				&begin, &end)) {
+			const char *value = line + begin;
+			const char *equal = static_cast<const char *>(
+				std::memchr(value, '=', end - begin));
+			if (equal == nullptr) {
+				continue;
+			}
+			const char *semicolon = static_cast<const char *>(
+				std::memchr(equal, ';', line + end - equal));
+			if (semicolon == nullptr) {
+				semicolon = line + end;
+			}
+			std::string name(value, equal - value);
+			std::string cookieValue(equal + 1, semicolon - equal - 1);
+			// the value is the session, never log it
+			nicolive_log_debug("header set cookie: %s",
+				name.c_str());
+			this->cookie[name] = cookieValue;
+			// a response with a new cookie is not for others
+			storable = false;
+		} else if (!options.cache) {
+			continue;
+		} else if (headerValue(line, lineLength, "ETag",
+				&begin, &end)) {
+			etag = line + begin;
+			etagLength = end - begin;
+		} else if (headerValue(line, lineLength, "Last-Modified",
+				&begin, &end)) {
+			lastModified = line + begin;
+			lastModifiedLength = end - begin;
+		} else if (headerValue(line, lineLength, "Cache-Control",
+				&begin, &end)) {
+			parseCacheControl(line + begin, end - begin,
+				&storable, &maxAge);
 		}
 	}
 	nicolive_log_debug("body: %s", bodyData.c_str());
 
-	*response = bodyData;
+	auto now = std::chrono::steady_clock::now();
+	if (*code == 304 && cached != nullptr) {
+		nicolive_log_debug("not modified: %s", url.c_str());
+		this->metrics.cacheRevalidated++;
+		*code = cached->code;
+		*response = cached->body;
+		this->lastBodyHash = cached->bodyHash;
+		if (maxAge > 0) {
+			cached->expires = now + std::chrono::seconds(maxAge);
+		}
+		return true;
+	}
+
+	// hand over the buffer, the old response buffer is reused next time
+	response->swap(bodyData);
+
+	if (storable && *code == 200 && (maxAge > 0 || etagLength > 0 ||
+			lastModifiedLength > 0)) {
+		// the entry of the last poll is updated in place
+		auto found = this->cache.find(cacheKey);
+		if (found == this->cache.end()) {
+			if (this->cache.size() >=
+					NicoLiveApi::MAX_CACHE_ENTRIES) {
+				this->cache.clear();
+			}
+			found = this->cache.emplace(cacheKey,
+				CacheEntry()).first;
+		}
+		CacheEntry &entry = found->second;
+		entry.code = *code;
+		entry.body = *response;
+		entry.bodyHash = this->lastBodyHash;
+		entry.etag.assign(etag != nullptr ? etag : "", etagLength);
+		entry.lastModified.assign(
+			lastModified != nullptr ? lastModified : "",
+			lastModifiedLength);
+		entry.expires = now + std::chrono::seconds(maxAge);
+	} else if (options.cache) {
+		this->cache.erase(cacheKey);
+	}
 
 	return true;
 }
@@ -277,7 +863,7 @@ bool NicoLiveApi::getWeb(
 {
 	std::unordered_map<std::string, std::string> formData;
 	return this->accessWeb(url, NicoLiveApi::Method::GET,
-		formData, code, response);
+		formData, code, response, NicoLiveApi::AccessOptions());
 }
 
 bool NicoLiveApi::postWeb(
@@ -287,7 +873,7 @@ bool NicoLiveApi::postWeb(
 	std::string *response)
 {
 	return this->accessWeb(url, NicoLiveApi::Method::POST,
-		formData, code, response);
+		formData, code, response, NicoLiveApi::AccessOptions());
 }
 
 bool NicoLiveApi::loginSite(
@@ -296,7 +882,7 @@ bool NicoLiveApi::loginSite(
 	const std::string &password)
 {
 	std::string url;
-	url += NicoLiveApi::LOGIN_SITE_URL;
+	url += this->loginSiteUrl;
 	url += "?site=";
 	url += NicoLiveApi::urlEncode(site);
 	std::unordered_map<std::string, std::string> formData;
@@ -309,8 +895,16 @@ bool NicoLiveApi::loginSite(
 
 	this->clearCookie();
 
+	// only the status and the cookie of the redirect are needed
+	NicoLiveApi::AccessOptions options;
+	options.endpoint = NicoLiveApi::Endpoint::LOGIN_SITE;
+	options.completeHeader = [](int code) {
+		return code == 302;
+	};
+
 	nicolive_log_info("login site: %s", site.c_str());
-	bool result = this->postWeb(url, formData, &code, &response);
+	bool result = this->accessWeb(url, NicoLiveApi::Method::POST,
+		formData, &code, &response, options);
 	if (result) {
 		if (code == 302) {
 			// TODO: check redirect location?
@@ -365,8 +959,11 @@ std::string NicoLiveApi::loginApiTicket(
 	this->clearCookie();
 
 	nicolive_log_info("login api site: %s", site.c_str());
-	bool result = this->postWeb(NicoLiveApi::LOGIN_API_URL, formData,
-		&code, &response);
+	NicoLiveApi::AccessOptions options;
+	options.endpoint = NicoLiveApi::Endpoint::LOGIN_API;
+	bool result = this->accessWeb(this->loginApiUrl,
+		NicoLiveApi::Method::POST, formData, &code, &response,
+		options);
 
 	if (!result) {
 		nicolive_log_error("access login api errror");
@@ -416,11 +1013,20 @@ std::string NicoLiveApi::loginNicoliveEncoder(
 }
 
 bool NicoLiveApi::getPublishStatus(
-	std::unordered_map<std::string, std::vector<std::string>> *data)
+	std::unordered_map<std::string, std::vector<std::string>> *data,
+	bool *changed)
 {
 	int code;
-	std::string response;
-	if (!this->getWeb(NicoLiveApi::PUBSTAT_URL, &code, &response)) {
+	std::string &response = this->pubStatResponse;
+	std::unordered_map<std::string, std::string> formData;
+	NicoLiveApi::AccessOptions options;
+	options.hedge = this->useHedge;
+	options.cache = true;
+	options.completeBody = NicoLiveApi::completePublishStatus;
+	options.endpoint = NicoLiveApi::Endpoint::PUBSTAT;
+	if (!this->accessWeb(this->pubStatUrl,
+			NicoLiveApi::Method::GET, formData, &code, &response,
+			options)) {
 		nicolive_log_error("failed to get publish status");
 		return false;
 	}
@@ -431,21 +1037,30 @@ bool NicoLiveApi::getPublishStatus(
 		return false;
 	}
 
-	return NicoLiveApi::parseXml(response, data);
+	return this->parsePublishStatus(response, data, changed);
 }
 
 bool NicoLiveApi::getPublishStatusTicket(
 	const std::string &ticket,
-	std::unordered_map<std::string, std::vector<std::string>> *data)
+	std::unordered_map<std::string, std::vector<std::string>> *data,
+	bool *changed)
 {
-	std::unordered_map<std::string, std::string> formData;
+	// the values are assigned into the strings of the last poll
+	std::unordered_map<std::string, std::string> &formData =
+		this->pubStatForm;
 	formData["ticket"] = ticket;
 	formData["accept-multi"] = "0";
 
 	int code;
-	std::string response;
-	if (!this->postWeb(NicoLiveApi::PUBSTAT_URL, formData,
-			&code, &response)) {
+	std::string &response = this->pubStatResponse;
+	NicoLiveApi::AccessOptions options;
+	options.hedge = this->useHedge;
+	options.cache = true;
+	options.completeBody = NicoLiveApi::completePublishStatus;
+	options.endpoint = NicoLiveApi::Endpoint::PUBSTAT;
+	if (!this->accessWeb(this->pubStatUrl,
+			NicoLiveApi::Method::POST, formData, &code, &response,
+			options)) {
 		nicolive_log_error("failed to get publish status ticket");
 		return false;
 	}
@@ -457,5 +1072,55 @@ bool NicoLiveApi::getPublishStatusTicket(
 		return false;
 	}
 
-	return NicoLiveApi::parseXml(response, data);
+	return this->parsePublishStatus(response, data, changed);
+}
+
+// All needed elements of getpublishstatus are in stream and rtmp, or error
+// when failed. Elements after them are not downloaded.
+size_t NicoLiveApi::completePublishStatus(const std::string &body)
+{
+	static const std::string errorEnd = "</error>";
+	static const std::string endTimeEnd = "</end_time>";
+	static const std::string rtmpEnd = "</rtmp>";
+
+	size_t pos = body.find(errorEnd);
+	if (pos != std::string::npos) {
+		return pos + errorEnd.size();
+	}
+	size_t endTimePos = body.find(endTimeEnd);
+	size_t rtmpPos = body.find(rtmpEnd);
+	if (endTimePos == std::string::npos || rtmpPos == std::string::npos) {
+		return 0;
+	}
+	return std::max(endTimePos + endTimeEnd.size(),
+		rtmpPos + rtmpEnd.size());
+}
+
+void NicoLiveApi::resetPublishStatusHash()
+{
+	this->pubStatHashValid = false;
+}
+
+bool NicoLiveApi::parsePublishStatus(
+	const std::string &response,
+	std::unordered_map<std::string, std::vector<std::string>> *data,
+	bool *changed)
+{
+	if (changed != nullptr) {
+		if (this->pubStatHashValid &&
+				this->pubStatHash == this->lastBodyHash) {
+			nicolive_log_debug("publish status is unchanged");
+			*changed = false;
+			return true;
+		}
+		*changed = true;
+	}
+
+	if (!NicoLiveApi::parseXml(response, data, true)) {
+		this->pubStatHashValid = false;
+		return false;
+	}
+	this->pubStatHash = this->lastBodyHash;
+	this->pubStatHashValid = true;
+	return true;
 }
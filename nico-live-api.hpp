@@ -1,50 +1,194 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
+#include "nico-live-histogram.hpp"
+#include "nico-live-transport.hpp"
 
 class NicoLiveApi {
 	enum class Method {
 		GET,
 		POST,
 	};
+	struct CacheEntry {
+		int code = 0;
+		std::string body;
+		uint64_t bodyHash = 0;
+		std::string etag;
+		std::string lastModified;
+		std::chrono::steady_clock::time_point expires;
+	};
 public:
+	enum class TrafficMode {
+		OFF,
+		RECORD,
+		REPLAY,
+		REPLAY_TIMED,
+	};
+	enum class Endpoint {
+		OTHER,
+		LOGIN_SITE,
+		LOGIN_API,
+		PUBSTAT,
+		COUNT,
+	};
+	// where the time of requests to an endpoint is spent
+	struct EndpointTimings {
+		long long requests = 0;
+		long long reused = 0;
+		long long responseBytes = 0;
+		NicoLiveHistogram nameLookup;
+		NicoLiveHistogram connect;
+		NicoLiveHistogram tls;
+		// from the request sent to the first response byte
+		NicoLiveHistogram server;
+		NicoLiveHistogram transfer;
+		NicoLiveHistogram total;
+	};
+	struct AccessOptions {
+		Endpoint endpoint = Endpoint::OTHER;
+		bool hedge = false;
+		// use and store the response cache
+		bool cache = false;
+		// Stop the transfer when all needed data has arrived.
+		// completeHeader gets the status code at the end of headers,
+		// completeBody gets the body so far and returns the length to
+		// keep, or 0 to continue.
+		std::function<bool(int)> completeHeader;
+		std::function<size_t(const std::string &)> completeBody;
+	};
+	typedef NicoLiveMetrics Metrics;
 	static const std::string LOGIN_SITE_URL;
 	static const std::string LOGIN_API_URL;
 	static const std::string PUBSTAT_URL;
+	// an access outside an operation, which may block the GUI thread
+	static const long long DEFAULT_TIMEOUT_MSEC = 10 * 1000; // 10s
+	// hedge after the percentile of recent latencies
+	static const int HEDGE_PERCENTILE = 95;
+	static const size_t HEDGE_MIN_SAMPLES = 8;
+	static const size_t HEDGE_MAX_SAMPLES = 64;
+	static const long long HEDGE_DEFAULT_MSEC = 1000; // 1s
+	static const long long HEDGE_MIN_MSEC = 200; // 0.2s
+	static const uint64_t HASH_INIT = 14695981039346656037ULL;
+	static const size_t MAX_CACHE_ENTRIES = 16;
+	static const size_t MAX_XPATH_CACHE_ENTRIES = 64;
 	static std::string createWwwFormUrlencoded(
 		const std::unordered_map<std::string, std::string> &formData);
 	static std::string createCookieString(
 		const std::unordered_map<std::string, std::string> &cookie);
+	// Append to *out, which keeps its capacity for the next access.
+	static void appendWwwFormUrlencoded(
+		const std::unordered_map<std::string, std::string> &formData,
+		std::string *out);
+	static void appendCookieString(
+		const std::unordered_map<std::string, std::string> &cookie,
+		std::string *out);
 	static bool parseXml(
 		const std::string &xml,
 		std::unordered_map<std::string, std::vector<std::string>>
-			*data);
+			*data,
+		bool allowUnclosed = false);
 	static std::string urlEncode(const std::string &str);
-	static size_t writeString(char *ptr, size_t size, size_t nmemb,
-		void *userdata);
+	static std::string replaceBaseUrl(const std::string &url,
+		const std::string &baseUrl);
+	static uint64_t hashString(uint64_t hash, const char *str,
+		size_t length);
+	static size_t completePublishStatus(const std::string &body);
+	// Find the value of a case-insensitive "Name: value" header line
+	// without allocation. The value is [*begin, *end) of line.
+	static bool headerValue(const char *line, size_t length,
+		const char *name, size_t *begin, size_t *end);
+	static bool headerValue(const char *line, size_t length,
+		const char *name, std::string *value);
 
 private:
 	std::unordered_map<std::string, std::string> cookie;
+	std::unique_ptr<NicoLiveTransport> transport;
+	std::string loginSiteUrl = LOGIN_SITE_URL;
+	std::string loginApiUrl = LOGIN_API_URL;
+	std::string pubStatUrl = PUBSTAT_URL;
+	TrafficMode trafficMode = TrafficMode::OFF;
+	std::string trafficPath;
+	Metrics metrics;
+	EndpointTimings timings[static_cast<int>(Endpoint::COUNT)];
+	// Reused by every access, a poll of an unchanged publish status does
+	// not allocate once their capacities have grown.
+	NicoLiveRequest request;
+	std::string cacheKey;
+	NicoLiveResponse lastResponse;
+	std::string pubStatResponse;
+	std::unordered_map<std::string, std::string> pubStatForm;
+	bool inOperation = false;
+	std::chrono::steady_clock::time_point deadline;
+	int remainingRequests = 0;
+	std::atomic<bool> canceled;
+	bool useHedge = false;
+	std::vector<long long> hedgeLatencies;
+	size_t hedgeNext = 0;
+	int hedgeCount = 0;
+	int hedgeWinCount = 0;
+	uint64_t lastBodyHash = HASH_INIT;
+	uint64_t pubStatHash = HASH_INIT;
+	bool pubStatHashValid = false;
+	std::unordered_map<std::string, CacheEntry> cache;
 
 public:
 	NicoLiveApi();
 	~NicoLiveApi();
 
+	const Metrics &getMetrics() const;
+	static const char *endpointName(Endpoint endpoint);
+	const EndpointTimings &getTimings(Endpoint endpoint) const;
+	void logTimings() const;
+
+	// Transport, curl by default. Takes ownership of transport.
+	void setTransport(NicoLiveTransport *transport);
+	// Record accesses to path, or replay them from path without network.
+	// Nothing is done if neither mode nor path is changed.
+	void setTraffic(TrafficMode mode, const std::string &path);
+	TrafficMode getTrafficMode() const;
+
+	// Endpoints
+	// Replace the scheme and host of all endpoints with baseUrl, e.g.
+	// "http://127.0.0.1:8080" for a stand-in server. Empty for defaults.
+	void setBaseUrl(const std::string &baseUrl);
+
+	// Deadline and cancellation
+	// An operation shares budgetMsec among its (at most) requests accesses.
+	void beginOperation(long long budgetMsec, int requests);
+	void endOperation();
+	// Stays canceled, also for later accesses, until clearCancel().
+	void cancel();
+	void clearCancel();
+	bool isCanceled() const;
+
+	// Hedged requests for publish status
+	void setEnabledHedge(bool enabled);
+	bool enabledHedge() const;
+
 	// Cookie
 	void setCookie(const std::string &name, const std::string &value);
 	void deleteCookie(const std::string &name);
 	void clearCookie();
 	const std::string getCookie(const std::string &name) const;
 
+	// Response cache
+	void clearCache();
+
 	// Generic
 	bool accessWeb(
 		const std::string &url,
 		const Method &method,
 		const std::unordered_map<std::string, std::string> &formData,
 		int *code,
-		std::string *response);
+		std::string *response,
+		const AccessOptions &options);
 	bool getWeb(
 		const std::string &url,
 		int *code,
@@ -74,11 +218,27 @@ public:
 	std::string loginNicoliveEncoder(
 		const std::string &mail,
 		const std::string &password);
+	// If changed is given, a response same as the last one is not parsed
+	// and data is left untouched with *changed = false.
 	bool getPublishStatus(
 		std::unordered_map<std::string,
-			std::vector<std::string>> *data);
+			std::vector<std::string>> *data,
+		bool *changed = nullptr);
 	bool getPublishStatusTicket(
 		const std::string &ticket,
 		std::unordered_map<std::string,
-			std::vector<std::string>> *data);
+			std::vector<std::string>> *data,
+		bool *changed = nullptr);
+	void resetPublishStatusHash();
+
+private:
+	long long nextTimeout();
+	long long hedgeThreshold() const;
+	void recordHedgeLatency(long long msec, bool hedgeWon);
+	void recordTiming(Endpoint endpoint, const NicoLiveResponse &response);
+	bool parsePublishStatus(
+		const std::string &response,
+		std::unordered_map<std::string,
+			std::vector<std::string>> *data,
+		bool *changed);
 };
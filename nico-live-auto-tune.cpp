@@ -0,0 +1,91 @@
+#include <cstring>
+#include "nicolive.h"
+#include "nico-live-auto-tune.hpp"
+
+namespace {
+	// fastest first
+	const char *const x264_presets[] = {
+		"ultrafast",
+		"superfast",
+		"veryfast",
+		"faster",
+		"fast",
+		"medium",
+	};
+	const int x264_preset_count =
+		sizeof(x264_presets) / sizeof(x264_presets[0]);
+
+	// a low cap leaves few bits per pixel, so scale down and spend the
+	// spare CPU on a slower preset
+	struct tuning_entry_s {
+		long long max_kbps;
+		int height;
+		const char *preset;
+	};
+	const tuning_entry_s tuning_table[] = {
+		{  500, 360, "medium"},
+		{ 1000, 480, "fast"},
+		{ 2000, 540, "faster"},
+		{ 4000, 720, "veryfast"},
+		{    0,   0, "veryfast"}, // no limit, no scaling
+	};
+}
+
+NicoLiveAutoTune::Tuning NicoLiveAutoTune::choose(long long bitrateKbps) const
+{
+	const tuning_entry_s *entry = tuning_table;
+	while (entry->max_kbps != 0 && bitrateKbps >= entry->max_kbps)
+		entry++;
+
+	int index = NicoLiveAutoTune::presetIndex(entry->preset) -
+		this->fasterSteps;
+	if (index < 0)
+		index = 0;
+
+	Tuning tuning;
+	tuning.height = entry->height;
+	tuning.preset = NicoLiveAutoTune::presetName(index);
+	// the cap of the live is a hard limit
+	tuning.rateControl = "CBR";
+	return tuning;
+}
+
+void NicoLiveAutoTune::reportBroadcast(long long frames,
+	long long skippedFrames)
+{
+	if (frames <= 0)
+		return;
+	if (skippedFrames * 1000 >=
+			frames * NicoLiveAutoTune::SKIPPED_HIGH_PERMILLE) {
+		if (this->fasterSteps < x264_preset_count - 1)
+			this->fasterSteps++;
+		nicolive_log_info("auto tune: skipped %lld of %lld frames, "
+			"%d steps faster preset", skippedFrames, frames,
+			this->fasterSteps);
+	} else if (skippedFrames == 0 && this->fasterSteps > 0) {
+		this->fasterSteps--;
+		nicolive_log_info("auto tune: no skipped frames, "
+			"%d steps faster preset", this->fasterSteps);
+	}
+}
+
+int NicoLiveAutoTune::getFasterSteps() const
+{
+	return this->fasterSteps;
+}
+
+int NicoLiveAutoTune::presetIndex(const char *preset)
+{
+	for (int i = 0; i < x264_preset_count; i++) {
+		if (std::strcmp(x264_presets[i], preset) == 0)
+			return i;
+	}
+	return 0;
+}
+
+const char *NicoLiveAutoTune::presetName(int index)
+{
+	if (index < 0 || index >= x264_preset_count)
+		return x264_presets[0];
+	return x264_presets[index];
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// Chooses the encoder preset, rate control and output height for the
+// bitrate cap of a live from a built-in table. The preset is made faster
+// by one step after a broadcast that skipped frames for encoding lag, and
+// slower again after a broadcast that skipped none.
+class NicoLiveAutoTune {
+public:
+	static const int SKIPPED_HIGH_PERMILLE = 10; // 1%
+	struct Tuning {
+		int height = 0; // 0 for no scaling
+		const char *preset = nullptr; // x264 preset
+		const char *rateControl = nullptr;
+	};
+private:
+	int fasterSteps = 0;
+public:
+	Tuning choose(long long bitrateKbps) const;
+	// frames rendered and skipped by the encoder in the last broadcast
+	void reportBroadcast(long long frames, long long skippedFrames);
+	int getFasterSteps() const;
+	static int presetIndex(const char *preset);
+	static const char *presetName(int index);
+};
@@ -0,0 +1,399 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#else
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#endif
+#include "nico-live-bandwidth-probe.hpp"
+#include "nicolive.h"
+
+namespace {
+	typedef std::chrono::steady_clock probe_clock;
+
+	const size_t RTMP_HANDSHAKE_SIZE = 1536;
+	const size_t RTMP_MAX_MESSAGE_SIZE = 0xffffff;
+
+	long long msec_until(probe_clock::time_point deadline)
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+			deadline - probe_clock::now()).count();
+	}
+
+	bool set_nonblocking(socket_t sock)
+	{
+#ifdef _WIN32
+		u_long mode = 1;
+		return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+		int flags = fcntl(sock, F_GETFL, 0);
+		return flags >= 0 &&
+			fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+	}
+
+	bool in_progress()
+	{
+#ifdef _WIN32
+		int error = WSAGetLastError();
+		return error == WSAEWOULDBLOCK || error == WSAEINPROGRESS;
+#else
+		return errno == EINPROGRESS || errno == EWOULDBLOCK ||
+			errno == EAGAIN || errno == EINTR;
+#endif
+	}
+
+	// wait at most 100ms so that a cancel is noticed
+	int wait_socket(socket_t sock, bool write,
+		probe_clock::time_point deadline)
+	{
+		long long msec = msec_until(deadline);
+		if (msec <= 0)
+			return 0;
+		if (msec > 100)
+			msec = 100;
+		fd_set fds;
+		FD_ZERO(&fds);
+		FD_SET(sock, &fds);
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = static_cast<long>(msec * 1000);
+		return select(static_cast<int>(sock + 1),
+			write ? nullptr : &fds, write ? &fds : nullptr,
+			nullptr, &timeout);
+	}
+
+	socket_t connect_host(const std::string &host, int port,
+		probe_clock::time_point deadline,
+		const std::atomic<bool> &canceled)
+	{
+		struct addrinfo hints;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		struct addrinfo *addresses = nullptr;
+		std::string service = std::to_string(port);
+		if (getaddrinfo(host.c_str(), service.c_str(), &hints,
+				&addresses) != 0) {
+			nicolive_log_warn("probe: cannot resolve %s",
+				host.c_str());
+			return INVALID_SOCKET;
+		}
+
+		socket_t sock = INVALID_SOCKET;
+		for (struct addrinfo *address = addresses;
+				address != nullptr && sock == INVALID_SOCKET;
+				address = address->ai_next) {
+			sock = socket(address->ai_family, address->ai_socktype,
+				address->ai_protocol);
+			if (sock == INVALID_SOCKET)
+				continue;
+			int size = NicoLiveBandwidthProbe::SEND_BUFFER_SIZE;
+			setsockopt(sock, SOL_SOCKET, SO_SNDBUF,
+				reinterpret_cast<const char *>(&size),
+				sizeof(size));
+			if (!set_nonblocking(sock) ||
+					(connect(sock, address->ai_addr,
+						static_cast<int>(
+							address->ai_addrlen))
+						!= 0 && !in_progress())) {
+				close_socket(sock);
+				sock = INVALID_SOCKET;
+				continue;
+			}
+			int ready = 0;
+			while (ready == 0 && !canceled &&
+					msec_until(deadline) > 0)
+				ready = wait_socket(sock, true, deadline);
+			int error = 0;
+			socklen_t length = sizeof(error);
+			if (ready <= 0 || getsockopt(sock, SOL_SOCKET,
+					SO_ERROR,
+					reinterpret_cast<char *>(&error),
+					&length) != 0 || error != 0) {
+				close_socket(sock);
+				sock = INVALID_SOCKET;
+			}
+		}
+		freeaddrinfo(addresses);
+		return sock;
+	}
+
+	bool send_all(socket_t sock, const char *data, size_t size,
+		probe_clock::time_point deadline,
+		const std::atomic<bool> &canceled)
+	{
+		while (size > 0) {
+			if (canceled || msec_until(deadline) <= 0)
+				return false;
+			if (wait_socket(sock, true, deadline) <= 0)
+				continue;
+			int sent = static_cast<int>(send(sock, data,
+				static_cast<int>(size), 0));
+			if (sent < 0) {
+				if (in_progress())
+					continue;
+				return false;
+			}
+			data += sent;
+			size -= static_cast<size_t>(sent);
+		}
+		return true;
+	}
+
+	bool receive_all(socket_t sock, char *data, size_t size,
+		probe_clock::time_point deadline,
+		const std::atomic<bool> &canceled)
+	{
+		while (size > 0) {
+			if (canceled || msec_until(deadline) <= 0)
+				return false;
+			if (wait_socket(sock, false, deadline) <= 0)
+				continue;
+			int received = static_cast<int>(recv(sock, data,
+				static_cast<int>(size), 0));
+			if (received == 0)
+				return false;
+			if (received < 0) {
+				if (in_progress())
+					continue;
+				return false;
+			}
+			data += received;
+			size -= static_cast<size_t>(received);
+		}
+		return true;
+	}
+
+	void append_uint(std::vector<char> *data, unsigned long value,
+		int bytes)
+	{
+		for (int i = bytes - 1; i >= 0; i--)
+			data->push_back(static_cast<char>(
+				(value >> (i * 8)) & 0xff));
+	}
+
+	// C0, C1, S0, S1, S2 and C2, then the chunk size is raised so that
+	// the padding message goes without chunk headers
+	bool rtmp_handshake(socket_t sock, probe_clock::time_point deadline,
+		const std::atomic<bool> &canceled)
+	{
+		std::vector<char> c0c1(1 + RTMP_HANDSHAKE_SIZE, 0);
+		c0c1[0] = 0x03;
+		std::mt19937 random(std::random_device{}());
+		for (size_t i = 9; i < c0c1.size(); i++)
+			c0c1[i] = static_cast<char>(random());
+		if (!send_all(sock, c0c1.data(), c0c1.size(), deadline,
+				canceled))
+			return false;
+
+		std::vector<char> s0s1s2(1 + 2 * RTMP_HANDSHAKE_SIZE);
+		if (!receive_all(sock, s0s1s2.data(), s0s1s2.size(), deadline,
+				canceled) || s0s1s2[0] != 0x03)
+			return false;
+		if (!send_all(sock, s0s1s2.data() + 1, RTMP_HANDSHAKE_SIZE,
+				deadline, canceled))
+			return false;
+
+		std::vector<char> messages;
+		// set chunk size on chunk stream 2
+		messages.push_back(0x02);
+		append_uint(&messages, 0, 3); // timestamp
+		append_uint(&messages, 4, 3); // length
+		messages.push_back(0x01); // type
+		append_uint(&messages, 0, 4); // stream id
+		append_uint(&messages, RTMP_MAX_MESSAGE_SIZE, 4);
+		// AMF0 data message on chunk stream 3, followed by padding
+		messages.push_back(0x03);
+		append_uint(&messages, 0, 3);
+		append_uint(&messages, RTMP_MAX_MESSAGE_SIZE, 3);
+		messages.push_back(0x12);
+		append_uint(&messages, 0, 4);
+		return send_all(sock, messages.data(), messages.size(),
+			deadline, canceled);
+	}
+}
+
+NicoLiveBandwidthProbe::NicoLiveBandwidthProbe() :
+	probing(false), canceled(false)
+{
+}
+
+NicoLiveBandwidthProbe::~NicoLiveBandwidthProbe()
+{
+	this->cancel();
+}
+
+void NicoLiveBandwidthProbe::setProtocol(Protocol protocol)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->protocol = protocol;
+}
+
+NicoLiveBandwidthProbe::Result NicoLiveBandwidthProbe::measure(
+	const std::string &host, int port, int durationMsec)
+{
+	Protocol protocol;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		protocol = this->protocol;
+	}
+	this->canceled = false;
+
+	Result result;
+	result.host = host;
+	result.port = port;
+	result.time = probe_clock::now();
+	result.kbps = NicoLiveBandwidthProbe::run(host, port, protocol,
+		durationMsec, this->canceled);
+	result.ok = result.kbps > 0;
+	if (result.ok) {
+		nicolive_log_info("probe: %s:%d upload %lld kbps",
+			host.c_str(), port, result.kbps);
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->last = result;
+	} else {
+		nicolive_log_warn("probe: failed to measure %s:%d",
+			host.c_str(), port);
+	}
+	return result;
+}
+
+void NicoLiveBandwidthProbe::measureAsync(const std::string &host, int port)
+{
+	if (this->probing)
+		return;
+	if (this->thread.joinable())
+		this->thread.join();
+	this->probing = true;
+	this->thread = std::thread([this, host, port]() {
+		this->measure(host, port);
+		this->probing = false;
+	});
+}
+
+bool NicoLiveBandwidthProbe::getFreshResult(const std::string &host,
+	int port, Result *result)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (!this->last.ok || this->last.host != host ||
+			this->last.port != port)
+		return false;
+	if (probe_clock::now() - this->last.time > std::chrono::seconds(
+			static_cast<int>(NicoLiveBandwidthProbe::FRESH_SEC)))
+		return false;
+	*result = this->last;
+	return true;
+}
+
+void NicoLiveBandwidthProbe::cancel()
+{
+	this->canceled = true;
+	if (this->thread.joinable())
+		this->thread.join();
+}
+
+bool NicoLiveBandwidthProbe::parseRtmpUrl(const std::string &url,
+	std::string *host, int *port)
+{
+	const std::string scheme = "rtmp://";
+	if (url.compare(0, scheme.size(), scheme) != 0)
+		return false;
+	size_t begin = scheme.size();
+	size_t end = url.find('/', begin);
+	std::string authority = url.substr(begin,
+		end == std::string::npos ? std::string::npos : end - begin);
+	size_t colon = authority.rfind(':');
+	if (colon != std::string::npos &&
+			authority.find(']', colon) == std::string::npos) {
+		*host = authority.substr(0, colon);
+		*port = std::atoi(authority.c_str() + colon + 1);
+	} else {
+		*host = authority;
+		*port = NicoLiveBandwidthProbe::DEFAULT_PORT;
+	}
+	if (host->size() > 2 && host->front() == '[' && host->back() == ']')
+		*host = host->substr(1, host->size() - 2);
+	return !host->empty() && *port > 0 && *port < 65536;
+}
+
+long long NicoLiveBandwidthProbe::run(const std::string &host, int port,
+	Protocol protocol, int durationMsec,
+	const std::atomic<bool> &canceled)
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return 0;
+#endif
+	long long kbps = 0;
+	socket_t sock = connect_host(host, port, probe_clock::now() +
+		std::chrono::milliseconds(static_cast<int>(
+			NicoLiveBandwidthProbe::CONNECT_TIMEOUT_MSEC)),
+		canceled);
+	if (sock != INVALID_SOCKET) {
+		auto start = probe_clock::now();
+		auto deadline = start + std::chrono::milliseconds(
+			NicoLiveBandwidthProbe::CONNECT_TIMEOUT_MSEC +
+			durationMsec);
+		bool ready = protocol != Protocol::RTMP ||
+			rtmp_handshake(sock, deadline, canceled);
+
+		start = probe_clock::now();
+		auto warm = start + std::chrono::milliseconds(
+			static_cast<int>(NicoLiveBandwidthProbe::WARMUP_MSEC));
+		deadline = start + std::chrono::milliseconds(durationMsec);
+		std::vector<char> padding(16 * 1024, 0);
+		size_t remaining = RTMP_MAX_MESSAGE_SIZE;
+		long long total = 0;
+		long long counted = 0;
+		probe_clock::time_point end = start;
+		while (ready && !canceled && remaining > 0 &&
+				msec_until(deadline) > 0) {
+			if (wait_socket(sock, true, deadline) <= 0)
+				continue;
+			size_t size = padding.size();
+			if (protocol == Protocol::RTMP && size > remaining)
+				size = remaining;
+			int sent = static_cast<int>(send(sock, padding.data(),
+				static_cast<int>(size), 0));
+			if (sent < 0) {
+				if (in_progress())
+					continue;
+				break;
+			}
+			if (protocol == Protocol::RTMP)
+				remaining -= static_cast<size_t>(sent);
+			total += sent;
+			end = probe_clock::now();
+			if (end >= warm)
+				counted += sent;
+		}
+		// a fast link may send the whole message within the warmup
+		auto from = counted > 0 ? warm : start;
+		long long msec = std::chrono::duration_cast<
+			std::chrono::milliseconds>(end - from).count();
+		if (ready && !canceled && msec > 0)
+			kbps = (counted > 0 ? counted : total) * 8 / msec;
+		close_socket(sock);
+	}
+#ifdef _WIN32
+	WSACleanup();
+#endif
+	return kbps;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Measures the sustainable upload throughput to the RTMP host by sending
+// padding for a few seconds. After the RTMP handshake, the padding is one
+// large data message, which the server has to read before it can reject
+// it. The send buffer is kept small and the first WARMUP_MSEC are not
+// counted, so the rate is what the network drains, not what the kernel
+// buffers.
+class NicoLiveBandwidthProbe {
+public:
+	static const int DEFAULT_PORT = 1935;
+	static const int DURATION_MSEC = 3000;
+	static const int WARMUP_MSEC = 500;
+	static const int CONNECT_TIMEOUT_MSEC = 5000;
+	static const int SEND_BUFFER_SIZE = 64 * 1024;
+	static const int FRESH_SEC = 10 * 60;
+	enum class Protocol {
+		RTMP,
+		RAW, // no handshake, for a plain TCP sink
+	};
+	struct Result {
+		bool ok = false;
+		long long kbps = 0;
+		std::string host;
+		int port = 0;
+		std::chrono::steady_clock::time_point time;
+	};
+private:
+	std::mutex mutex;
+	Result last;
+	std::thread thread;
+	std::atomic<bool> probing;
+	std::atomic<bool> canceled;
+	Protocol protocol = Protocol::RTMP;
+public:
+	NicoLiveBandwidthProbe();
+	~NicoLiveBandwidthProbe();
+	void setProtocol(Protocol protocol);
+	// blocking
+	Result measure(const std::string &host, int port,
+		int durationMsec = DURATION_MSEC);
+	// in the background, ignored while another probe runs
+	void measureAsync(const std::string &host, int port);
+	// a result of the host younger than FRESH_SEC
+	bool getFreshResult(const std::string &host, int port, Result *result);
+	// also waits for the background probe
+	void cancel();
+	// rtmp://host[:port]/app/... to host and port
+	static bool parseRtmpUrl(const std::string &url, std::string *host,
+		int *port);
+private:
+	static long long run(const std::string &host, int port,
+		Protocol protocol, int durationMsec,
+		const std::atomic<bool> &canceled);
+};
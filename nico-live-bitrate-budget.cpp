@@ -0,0 +1,51 @@
+#include <cstddef>
+#include "nico-live-bitrate-budget.hpp"
+
+namespace {
+	// common AAC bitrates, ascending
+	const long long audio_steps[] = {
+		48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 288, 320,
+	};
+	const int audio_step_count =
+		sizeof(audio_steps) / sizeof(audio_steps[0]);
+}
+
+NicoLiveBitrateBudget::Plan NicoLiveBitrateBudget::plan(long long capKbps,
+	const std::vector<long long> &audioKbps, bool lowerAudio)
+{
+	Plan plan;
+	plan.audioKbps = audioKbps;
+
+	long long audioSum = 0;
+	for (long long kbps: plan.audioKbps)
+		audioSum += kbps;
+
+	while (lowerAudio &&
+			capKbps - audioSum < NicoLiveBitrateBudget::VIDEO_FLOOR_KBPS) {
+		std::size_t largest = 0;
+		for (std::size_t i = 1; i < plan.audioKbps.size(); i++) {
+			if (plan.audioKbps[i] > plan.audioKbps[largest])
+				largest = i;
+		}
+		if (plan.audioKbps.empty() || plan.audioKbps[largest] <=
+				NicoLiveBitrateBudget::AUDIO_MIN_KBPS)
+			break;
+		long long lowered = NicoLiveBitrateBudget::lowerAudioStep(
+			plan.audioKbps[largest]);
+		audioSum -= plan.audioKbps[largest] - lowered;
+		plan.audioKbps[largest] = lowered;
+	}
+
+	plan.videoKbps = capKbps - audioSum;
+	plan.ok = plan.videoKbps >= NicoLiveBitrateBudget::VIDEO_MIN_KBPS;
+	return plan;
+}
+
+long long NicoLiveBitrateBudget::lowerAudioStep(long long kbps)
+{
+	for (int i = audio_step_count - 1; i >= 0; i--) {
+		if (audio_steps[i] < kbps)
+			return audio_steps[i];
+	}
+	return NicoLiveBitrateBudget::AUDIO_MIN_KBPS;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+
+// Splits the bitrate cap of a live across the video and every audio track.
+// The video gets what the audio tracks leave. If that is under the quality
+// floor and lowering audio is allowed, the largest audio track steps down
+// one AAC bitrate at a time until the video reaches the floor or every
+// track is at the audio minimum.
+class NicoLiveBitrateBudget {
+public:
+	static const long long VIDEO_MIN_KBPS = 200; // cannot stream below
+	static const long long VIDEO_FLOOR_KBPS = 400; // looks acceptable
+	static const long long AUDIO_MIN_KBPS = 48;
+	struct Plan {
+		bool ok = false;
+		long long videoKbps = 0;
+		std::vector<long long> audioKbps;
+	};
+	static Plan plan(long long capKbps,
+		const std::vector<long long> &audioKbps, bool lowerAudio);
+private:
+	static long long lowerAudioStep(long long kbps);
+};
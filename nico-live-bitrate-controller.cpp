@@ -0,0 +1,99 @@
+#include "nico-live-bitrate-controller.hpp"
+
+void NicoLiveBitrateController::reset(long long capKbps)
+{
+	this->capKbps = capKbps;
+	this->kbps = capKbps;
+	this->holdSamples = 0;
+	this->stableSamples = 0;
+	this->lastReason = Reason::NONE;
+	this->stats.capKbps = capKbps;
+	this->stats.kbps = capKbps;
+}
+
+bool NicoLiveBitrateController::update(float congestion, int frames,
+	int droppedFrames)
+{
+	if (this->capKbps <= NicoLiveBitrateController::MIN_KBPS)
+		return false;
+
+	int congestionPercent = static_cast<int>(congestion * 100.0f);
+	bool dropping = frames > 0 && droppedFrames * 1000 >=
+		frames * NicoLiveBitrateController::HIGH_DROP_PERMILLE;
+	bool congested = congestionPercent >=
+		NicoLiveBitrateController::HIGH_CONGESTION_PERCENT;
+	bool calm = droppedFrames == 0 && congestionPercent <=
+		NicoLiveBitrateController::LOW_CONGESTION_PERCENT;
+
+	if (this->holdSamples > 0)
+		this->holdSamples--;
+	if (calm)
+		this->stableSamples++;
+	else
+		this->stableSamples = 0;
+
+	long long next = this->kbps;
+	Reason reason = Reason::NONE;
+	if ((congested || dropping) && this->holdSamples == 0) {
+		next = this->kbps *
+			(100 - NicoLiveBitrateController::DECREASE_PERCENT) /
+			100;
+		if (next < NicoLiveBitrateController::MIN_KBPS)
+			next = NicoLiveBitrateController::MIN_KBPS;
+		reason = congested ? Reason::CONGESTION :
+			Reason::DROPPED_FRAMES;
+		// give the encoder and the network time to settle
+		this->holdSamples = NicoLiveBitrateController::HOLD_SAMPLES;
+	} else if (this->kbps < this->capKbps && this->holdSamples == 0 &&
+			this->stableSamples >=
+				NicoLiveBitrateController::STABLE_SAMPLES) {
+		next = this->kbps + this->capKbps *
+			NicoLiveBitrateController::INCREASE_PERCENT_OF_CAP /
+			100;
+		if (next > this->capKbps)
+			next = this->capKbps;
+		reason = Reason::RECOVERED;
+		this->stableSamples = 0;
+	}
+
+	if (next == this->kbps)
+		return false;
+	if (next < this->kbps)
+		this->stats.decreases++;
+	else
+		this->stats.increases++;
+	this->kbps = next;
+	this->stats.kbps = next;
+	this->lastReason = reason;
+	return true;
+}
+
+long long NicoLiveBitrateController::getKbps() const
+{
+	return this->kbps;
+}
+
+NicoLiveBitrateController::Reason
+NicoLiveBitrateController::getLastReason() const
+{
+	return this->lastReason;
+}
+
+NicoLiveBitrateController::Stats NicoLiveBitrateController::getStats() const
+{
+	return this->stats;
+}
+
+const char *NicoLiveBitrateController::reasonName(Reason reason)
+{
+	switch (reason) {
+	case Reason::CONGESTION:
+		return "congestion";
+	case Reason::DROPPED_FRAMES:
+		return "dropped_frames";
+	case Reason::RECOVERED:
+		return "recovered";
+	default:
+		return "none";
+	}
+}
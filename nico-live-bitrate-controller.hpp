@@ -0,0 +1,48 @@
+#pragma once
+
+// Congestion-driven video bitrate under the cap of the live.
+// Each sample lowers the bitrate multiplicatively on congestion or frame
+// drops, and raises it additively toward the cap only after the output
+// has been calm for a while, so it does not oscillate around a threshold.
+class NicoLiveBitrateController {
+public:
+	static const int MIN_KBPS = 200; // same as adjust_bitrate
+	static const int HIGH_CONGESTION_PERCENT = 50;
+	static const int LOW_CONGESTION_PERCENT = 10;
+	static const int HIGH_DROP_PERMILLE = 10; // 1%
+	static const int DECREASE_PERCENT = 20;
+	static const int INCREASE_PERCENT_OF_CAP = 5;
+	// samples to wait after a decrease and to stay calm before increase
+	static const int HOLD_SAMPLES = 10;
+	static const int STABLE_SAMPLES = 30;
+	enum class Reason {
+		NONE,
+		CONGESTION,
+		DROPPED_FRAMES,
+		RECOVERED,
+	};
+	struct Stats {
+		long long capKbps = 0;
+		long long kbps = 0;
+		long long decreases = 0;
+		long long increases = 0;
+	};
+private:
+	long long capKbps = 0;
+	long long kbps = 0;
+	int holdSamples = 0;
+	int stableSamples = 0;
+	Reason lastReason = Reason::NONE;
+	Stats stats;
+public:
+	// starts at the cap, which is also the bitrate set at initialize,
+	// the counts of decreases and increases are kept
+	void reset(long long capKbps);
+	// congestion is 0.0 to 1.0, frames are counted since the previous
+	// sample, returns true if the bitrate should change to getKbps()
+	bool update(float congestion, int frames, int droppedFrames);
+	long long getKbps() const;
+	Reason getLastReason() const;
+	Stats getStats() const;
+	static const char *reasonName(Reason reason);
+};
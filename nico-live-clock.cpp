@@ -0,0 +1,46 @@
+#include <QtCore>
+#include "nico-live-clock.hpp"
+
+NicoLiveClock *NicoLiveClock::system()
+{
+	static NicoLiveSystemClock systemClock;
+	return &systemClock;
+}
+
+NicoLiveSystemTimer::NicoLiveSystemTimer(QObject *parent) :
+	NicoLiveTimer(parent)
+{
+	this->timer = new QTimer(this);
+	this->timer->setSingleShot(true);
+	connect(this->timer, SIGNAL(timeout()), this, SIGNAL(timeout()));
+}
+
+void NicoLiveSystemTimer::start(int msec)
+{
+	this->timer->start(msec);
+}
+
+void NicoLiveSystemTimer::stop()
+{
+	this->timer->stop();
+}
+
+bool NicoLiveSystemTimer::isActive() const
+{
+	return this->timer->isActive();
+}
+
+int NicoLiveSystemTimer::remainingTime() const
+{
+	return this->timer->remainingTime();
+}
+
+QDateTime NicoLiveSystemClock::now() const
+{
+	return QDateTime::currentDateTime();
+}
+
+NicoLiveTimer *NicoLiveSystemClock::createTimer(QObject *parent)
+{
+	return new NicoLiveSystemTimer(parent);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QtCore>
+
+// Single-shot timer of a NicoLiveClock.
+class NicoLiveTimer : public QObject {
+	Q_OBJECT
+public:
+	NicoLiveTimer(QObject *parent = nullptr) : QObject(parent) {}
+	virtual ~NicoLiveTimer() {}
+	virtual void start(int msec) = 0;
+	virtual void stop() = 0;
+	virtual bool isActive() const = 0;
+	// msec, -1 if inactive
+	virtual int remainingTime() const = 0;
+signals:
+	void timeout();
+};
+
+// Source of the current time and timers. The system clock is the default;
+// a virtual clock runs the watcher in simulated time.
+class NicoLiveClock {
+public:
+	virtual ~NicoLiveClock() {}
+	virtual QDateTime now() const = 0;
+	virtual NicoLiveTimer *createTimer(QObject *parent) = 0;
+	static NicoLiveClock *system();
+};
+
+class NicoLiveSystemTimer : public NicoLiveTimer {
+	Q_OBJECT
+private:
+	QTimer *timer;
+public:
+	NicoLiveSystemTimer(QObject *parent = nullptr);
+	void start(int msec) override;
+	void stop() override;
+	bool isActive() const override;
+	int remainingTime() const override;
+};
+
+class NicoLiveSystemClock : public NicoLiveClock {
+public:
+	QDateTime now() const override;
+	NicoLiveTimer *createTimer(QObject *parent) override;
+};
@@ -0,0 +1,513 @@
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include "nico-live-curl-transport.hpp"
+#include "nico-live-api.hpp"
+#include "curl/curl.h"
+#include "nicolive.h"
+
+// TLS sessions, DNS and connections are shared by all handles
+static CURLSH *sharedHandle = nullptr;
+static std::mutex sharedMutex[CURL_LOCK_DATA_LAST];
+static std::once_flag sharedOnce;
+
+static void lockShared(CURL *handle, curl_lock_data data,
+	curl_lock_access access, void *userptr)
+{
+	(void)handle;
+	(void)access;
+	(void)userptr;
+	sharedMutex[data].lock();
+}
+
+static void unlockShared(CURL *handle, curl_lock_data data, void *userptr)
+{
+	(void)handle;
+	(void)userptr;
+	sharedMutex[data].unlock();
+}
+
+static CURLSH *getSharedHandle()
+{
+	std::call_once(sharedOnce, []() {
+		sharedHandle = curl_share_init();
+		if (sharedHandle == nullptr) {
+			nicolive_log_warn("curl share init error");
+			return;
+		}
+		curl_share_setopt(sharedHandle, CURLSHOPT_LOCKFUNC, lockShared);
+		curl_share_setopt(sharedHandle, CURLSHOPT_UNLOCKFUNC,
+			unlockShared);
+		curl_share_setopt(sharedHandle, CURLSHOPT_SHARE,
+			CURL_LOCK_DATA_SSL_SESSION);
+		curl_share_setopt(sharedHandle, CURLSHOPT_SHARE,
+			CURL_LOCK_DATA_DNS);
+#if LIBCURL_VERSION_NUM >= 0x073900
+		curl_share_setopt(sharedHandle, CURLSHOPT_SHARE,
+			CURL_LOCK_DATA_CONNECT);
+#endif
+	});
+	return sharedHandle;
+}
+
+namespace {
+	// header and body point to the reusable buffers
+	struct Transfer {
+		CURL *curl = nullptr;
+		std::string *headerData = nullptr;
+		std::string *bodyData = nullptr;
+		uint64_t bodyHash = NicoLiveApi::HASH_INIT;
+		NicoLiveMetrics *metrics = nullptr;
+		const NicoLiveRequest *request = nullptr;
+		int code = 0;
+		// of the body, -1 if unknown
+		long long contentLength = -1;
+		// decoded body bytes, which are not fewer than the encoded
+		long long receivedLength = 0;
+		bool completed = false;
+	};
+}
+
+static int progressCallback(void *clientp, curl_off_t dltotal,
+	curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+{
+	(void)dltotal;
+	(void)dlnow;
+	(void)ultotal;
+	(void)ulnow;
+	const NicoLiveRequest *request =
+		static_cast<const NicoLiveRequest *>(clientp);
+	// non-zero aborts the transfer with CURLE_ABORTED_BY_CALLBACK
+	return (request->canceled != nullptr && *request->canceled) ? 1 : 0;
+}
+
+static void appendBuffer(std::string *buffer, const char *ptr, size_t length,
+	NicoLiveMetrics *metrics)
+{
+	if (buffer->size() + length > buffer->capacity()) {
+		metrics->bufferAllocations++;
+	}
+	buffer->append(ptr, length);
+}
+
+// Abort a completed transfer only if a long rest of the body is known to
+// follow, as the connection is closed by the abort.
+static bool abortsCompleted(const Transfer *transfer)
+{
+	return transfer->contentLength >= 0 &&
+		transfer->contentLength - transfer->receivedLength >
+		NicoLiveCurlTransport::ABORT_MIN_REMAINING_BYTES;
+}
+
+static size_t writeHeader(char *ptr, size_t size, size_t nmemb,
+	void *userdata)
+{
+	size_t length = size * nmemb;
+	Transfer *transfer = static_cast<Transfer *>(userdata);
+	appendBuffer(transfer->headerData, ptr, length, transfer->metrics);
+
+	if (length > 5 && std::strncmp(ptr, "HTTP/", 5) == 0) {
+		const char *status = static_cast<const char *>(
+			std::memchr(ptr, ' ', length));
+		if (status != nullptr) {
+			transfer->code = std::atoi(status + 1);
+		}
+	} else if ((length == 2 && ptr[0] == '\r') ||
+			(length == 1 && ptr[0] == '\n')) {
+		// end of headers, skip interim 1xx responses
+		if (transfer->code >= 200 &&
+				transfer->request->completeHeader &&
+				transfer->request->completeHeader(
+					transfer->code)) {
+			transfer->completed = true;
+			if (abortsCompleted(transfer)) {
+				// returning other than length aborts the
+				// transfer
+				return 0;
+			}
+		}
+		return length;
+	}
+
+	// pre-size the body
+	size_t begin;
+	size_t end;
+	if (NicoLiveApi::headerValue(ptr, length, "Content-Length",
+			&begin, &end)) {
+		char number[32];
+		size_t numberLength = std::min(end - begin, sizeof(number) - 1);
+		std::memcpy(number, ptr + begin, numberLength);
+		number[numberLength] = '\0';
+		long long contentLength = std::atoll(number);
+		transfer->contentLength = contentLength;
+		if (contentLength > 0 && static_cast<size_t>(contentLength) >
+				transfer->bodyData->capacity()) {
+			transfer->metrics->bufferAllocations++;
+			transfer->bodyData->reserve(
+				static_cast<size_t>(contentLength));
+		}
+	}
+	return length;
+}
+
+static size_t writeBody(char *ptr, size_t size, size_t nmemb, void *userdata)
+{
+	size_t length = size * nmemb;
+	Transfer *transfer = static_cast<Transfer *>(userdata);
+	transfer->receivedLength += static_cast<long long>(length);
+	if (transfer->completed) {
+		// the rest after all needed data, read to keep the connection
+		return length;
+	}
+	appendBuffer(transfer->bodyData, ptr, length, transfer->metrics);
+	transfer->bodyHash = NicoLiveApi::hashString(transfer->bodyHash,
+		ptr, length);
+
+	if (transfer->request->completeBody) {
+		size_t keep = transfer->request->completeBody(
+			*transfer->bodyData);
+		if (keep > 0) {
+			if (keep < transfer->bodyData->size()) {
+				transfer->bodyData->resize(keep);
+				transfer->bodyHash = NicoLiveApi::hashString(
+					NicoLiveApi::HASH_INIT,
+					transfer->bodyData->c_str(), keep);
+			}
+			transfer->completed = true;
+			if (abortsCompleted(transfer)) {
+				// returning other than length aborts the
+				// transfer
+				return 0;
+			}
+		}
+	}
+	return length;
+}
+
+static void setupTransfer(Transfer *transfer, const NicoLiveRequest &request,
+	struct curl_slist *headerList)
+{
+	CURL *curl = transfer->curl;
+
+	// URL
+	curl_easy_setopt(curl, CURLOPT_URL, request.url.c_str());
+
+	// connection
+	CURLSH *share = getSharedHandle();
+	if (share != nullptr) {
+		curl_easy_setopt(curl, CURLOPT_SHARE, share);
+	}
+	curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+#ifdef CURL_HTTP_VERSION_2TLS
+	curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+#endif
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+	// header and body data
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, transfer);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, writeHeader);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writeBody);
+	if (headerList != nullptr) {
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerList);
+	}
+
+	// deadline and cancellation
+	long long timeout = request.timeoutMsec;
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, static_cast<long>(timeout));
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, static_cast<long>(
+		std::min(timeout, static_cast<long long>(
+			NicoLiveCurlTransport::CONNECT_TIMEOUT_MSEC))));
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT,
+		NicoLiveCurlTransport::LOW_SPEED_LIMIT);
+	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME,
+		NicoLiveCurlTransport::LOW_SPEED_TIME);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, progressCallback);
+	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, &request);
+
+	if (request.url.find("https://") == 0) {
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 1L);
+		curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 1L);
+	}
+
+	// Cookie
+	if (!request.cookie.empty()) {
+		curl_easy_setopt(curl, CURLOPT_COOKIE, request.cookie.c_str());
+	}
+
+	// POST data
+	if (request.post) {
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE,
+			static_cast<long>(request.postData.size()));
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS,
+			request.postData.c_str());
+	}
+}
+
+// an aborted transfer which has got everything is a success
+static CURLcode transferResult(CURL *curl, CURLcode res)
+{
+	Transfer *transfer = nullptr;
+	curl_easy_getinfo(curl, CURLINFO_PRIVATE, &transfer);
+	if (res == CURLE_WRITE_ERROR && transfer != nullptr &&
+			transfer->completed) {
+		transfer->metrics->earlyCompletions++;
+		return CURLE_OK;
+	}
+	return res;
+}
+
+// Run first, and also second if first has not finished in hedgeMsec or has
+// failed. The first successful transfer wins and the other one is dropped.
+// *started is 1, or 2 if second was sent too.
+static CURLcode performHedged(CURL *first, CURL *second, long long hedgeMsec,
+	int *winner, int *started)
+{
+	*winner = 0;
+	*started = 1;
+	CURLM *multi = curl_multi_init();
+	if (multi == nullptr) {
+		return transferResult(first, curl_easy_perform(first));
+	}
+
+	curl_multi_add_handle(multi, first);
+	auto startTime = std::chrono::steady_clock::now();
+	bool hedged = false;
+	bool success = false;
+	int finished = 0;
+	CURLcode lastError = CURLE_OK;
+
+	while (!success && finished < (hedged ? 2 : 1)) {
+		int running = 0;
+		curl_multi_perform(multi, &running);
+
+		CURLMsg *msg;
+		int queued = 0;
+		while ((msg = curl_multi_info_read(multi, &queued)) != nullptr) {
+			if (msg->msg != CURLMSG_DONE) {
+				continue;
+			}
+			finished++;
+			CURLcode res = transferResult(msg->easy_handle,
+				msg->data.result);
+			if (res == CURLE_OK && !success) {
+				success = true;
+				*winner = (msg->easy_handle == first) ? 0 : 1;
+			} else {
+				lastError = res;
+			}
+		}
+		if (success) {
+			break;
+		}
+
+		long long elapsed =
+			std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - startTime)
+			.count();
+		if (!hedged && (elapsed >= hedgeMsec || finished > 0)) {
+			nicolive_log_debug("send hedged request after %lld ms",
+				elapsed);
+			curl_multi_add_handle(multi, second);
+			hedged = true;
+			*started = 2;
+			continue;
+		}
+
+		int waitMsec = 100;
+		if (!hedged) {
+			waitMsec = static_cast<int>(std::max(1LL,
+				std::min(hedgeMsec - elapsed, 100LL)));
+		}
+		curl_multi_wait(multi, nullptr, 0, waitMsec, nullptr);
+	}
+
+	curl_multi_remove_handle(multi, first);
+	if (hedged) {
+		curl_multi_remove_handle(multi, second);
+	}
+	curl_multi_cleanup(multi);
+	return success ? CURLE_OK : lastError;
+}
+
+static void readMetrics(CURL *curl, NicoLiveMetrics *metrics)
+{
+	long headerSize = 0;
+	long requestSize = 0;
+	long connects = 0;
+	double connectTime = 0.0;
+	double appConnectTime = 0.0;
+	curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &headerSize);
+	curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE, &requestSize);
+	curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+#if LIBCURL_VERSION_NUM >= 0x073700
+	curl_off_t bodySize = 0;
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bodySize);
+#else
+	double bodySize = 0.0;
+	curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD, &bodySize);
+#endif
+	curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connectTime);
+	curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &appConnectTime);
+
+	metrics->requests++;
+	metrics->sentBytes += requestSize;
+	metrics->receivedBytes += headerSize +
+		static_cast<long long>(bodySize);
+	if (connects == 0) {
+		metrics->reusedConnections++;
+	}
+	if (appConnectTime > connectTime) {
+		metrics->handshakes++;
+		metrics->handshakeUsec += static_cast<long long>(
+			(appConnectTime - connectTime) * 1000000.0);
+	}
+}
+
+static long long timeUsec(CURL *curl, CURLINFO info, CURLINFO infoDouble)
+{
+#if LIBCURL_VERSION_NUM >= 0x073d00
+	(void)infoDouble;
+	curl_off_t usec = 0;
+	curl_easy_getinfo(curl, info, &usec);
+	return static_cast<long long>(usec);
+#else
+	(void)info;
+	double sec = 0.0;
+	curl_easy_getinfo(curl, infoDouble, &sec);
+	return static_cast<long long>(sec * 1000000.0);
+#endif
+}
+
+#if LIBCURL_VERSION_NUM >= 0x073d00
+#define NICOLIVE_TIME_INFO(name) \
+		CURLINFO_##name##_TIME_T, CURLINFO_##name##_TIME
+#else
+#define NICOLIVE_TIME_INFO(name) \
+		CURLINFO_NONE, CURLINFO_##name##_TIME
+#endif
+
+static void readTiming(CURL *curl, NicoLiveTiming *timing, bool *reused)
+{
+	timing->nameLookupUsec = timeUsec(curl, NICOLIVE_TIME_INFO(NAMELOOKUP));
+	timing->connectUsec = timeUsec(curl, NICOLIVE_TIME_INFO(CONNECT));
+	timing->appConnectUsec = timeUsec(curl, NICOLIVE_TIME_INFO(APPCONNECT));
+	timing->startTransferUsec = timeUsec(curl,
+		NICOLIVE_TIME_INFO(STARTTRANSFER));
+	timing->totalUsec = timeUsec(curl, NICOLIVE_TIME_INFO(TOTAL));
+	long connects = 0;
+	curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+	*reused = connects == 0;
+}
+
+NicoLiveCurlTransport::NicoLiveCurlTransport()
+{
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+	this->curl = curl_easy_init();
+}
+
+NicoLiveCurlTransport::~NicoLiveCurlTransport()
+{
+	if (this->curl != nullptr) {
+		curl_easy_cleanup(this->curl);
+	}
+	curl_global_cleanup();
+}
+
+NicoLiveTransport::Result NicoLiveCurlTransport::perform(
+	const NicoLiveRequest &request,
+	NicoLiveResponse *response,
+	NicoLiveMetrics *metrics)
+{
+	bool hedge = request.hedgeMsec > 0;
+
+	// transfers[0] reuses the handle and its connection cache,
+	// transfers[1] is the hedged duplicate
+	Transfer transfers[2];
+	int transferCount = hedge ? 2 : 1;
+	transfers[0].curl = this->curl;
+	transfers[0].headerData = &response->header;
+	transfers[0].bodyData = &response->body;
+	if (hedge) {
+		transfers[1].curl = curl_easy_init();
+		transfers[1].headerData = &this->hedgeHeader;
+		transfers[1].bodyData = &this->hedgeBody;
+	}
+	if (transfers[0].curl == nullptr ||
+			(hedge && transfers[1].curl == nullptr)) {
+		nicolive_log_error("curl init error");
+		if (transfers[1].curl != nullptr) {
+			curl_easy_cleanup(transfers[1].curl);
+		}
+		return Result::INIT_ERROR;
+	}
+
+	struct curl_slist *headerList = nullptr;
+	for (auto &header: request.headers) {
+		headerList = curl_slist_append(headerList, header.c_str());
+	}
+
+	curl_easy_reset(transfers[0].curl);
+	for (int i = 0; i < transferCount; i++) {
+		transfers[i].metrics = metrics;
+		transfers[i].request = &request;
+		transfers[i].headerData->clear();
+		transfers[i].bodyData->clear();
+		if (transfers[i].bodyData->capacity() < this->lastBodySize) {
+			metrics->bufferAllocations++;
+			transfers[i].bodyData->reserve(this->lastBodySize);
+		}
+		setupTransfer(&transfers[i], request, headerList);
+	}
+
+	CURLcode res;
+	int winner = 0;
+	// of transfers, the duplicate is not sent if the first is fast
+	int started = 1;
+	if (hedge) {
+		curl_easy_setopt(transfers[1].curl, CURLOPT_FRESH_CONNECT, 1L);
+		res = performHedged(transfers[0].curl, transfers[1].curl,
+			request.hedgeMsec, &winner, &started);
+	} else {
+		res = transferResult(transfers[0].curl,
+			curl_easy_perform(transfers[0].curl));
+	}
+
+	for (int i = 0; i < started; i++) {
+		readMetrics(transfers[i].curl, metrics);
+	}
+	readTiming(transfers[winner].curl, &response->timing,
+		&response->reused);
+	if (hedge) {
+		curl_easy_cleanup(transfers[1].curl);
+	}
+	curl_slist_free_all(headerList);
+
+	if (res == CURLE_ABORTED_BY_CALLBACK) {
+		return Result::CANCELED;
+	} else if (res == CURLE_OPERATION_TIMEDOUT) {
+		return Result::TIMEOUT;
+	} else if (res != CURLE_OK) {
+		nicolive_log_error("curl failed: %s",
+			curl_easy_strerror(res));
+		response->error = curl_easy_strerror(res);
+		return Result::FAILED;
+	}
+
+	if (winner != 0) {
+		response->header.swap(this->hedgeHeader);
+		response->body.swap(this->hedgeBody);
+	}
+	response->code = transfers[winner].code;
+	response->bodyHash = transfers[winner].bodyHash;
+	response->hedgeWon = winner != 0;
+	this->lastBodySize = std::max(this->lastBodySize,
+		response->body.size());
+	return Result::OK;
+}
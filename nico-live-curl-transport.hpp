@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include "nico-live-transport.hpp"
+
+class NicoLiveCurlTransport : public NicoLiveTransport {
+public:
+	static const long long CONNECT_TIMEOUT_MSEC = 10 * 1000; // 10s
+	static const long LOW_SPEED_LIMIT = 16; // bytes/sec
+	static const long LOW_SPEED_TIME = 10; // sec
+	// A completed transfer is aborted, closing its connection, only if
+	// more than this is left of the body. A shorter rest is read to keep
+	// the connection alive.
+	static const long long ABORT_MIN_REMAINING_BYTES = 4 * 1024; // 4KB
+private:
+	void *curl = nullptr; // CURL *
+	// buffers of the hedged duplicate
+	std::string hedgeHeader;
+	std::string hedgeBody;
+	size_t lastBodySize = 0;
+public:
+	NicoLiveCurlTransport();
+	~NicoLiveCurlTransport();
+	Result perform(const NicoLiveRequest &request,
+		NicoLiveResponse *response, NicoLiveMetrics *metrics) override;
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+// Fixed-bucket latency histogram, cheap enough to update on every request.
+// Bucket 0 counts <= 1ms, bucket i counts (2^(i-1), 2^i] ms and the last
+// one counts everything longer, so the bounds are the inclusive "le" of
+// Prometheus.
+struct NicoLiveHistogram {
+	static const int BUCKETS = 18;
+	long long counts[BUCKETS] = {};
+	long long count = 0;
+	long long sumUsec = 0;
+	long long maxUsec = 0;
+
+	void add(long long usec)
+	{
+		if (usec < 0) {
+			usec = 0;
+		}
+		long long upperUsec = 1000;
+		int bucket = 0;
+		while (usec > upperUsec && bucket < BUCKETS - 1) {
+			upperUsec <<= 1;
+			bucket++;
+		}
+		this->counts[bucket]++;
+		this->count++;
+		this->sumUsec += usec;
+		if (usec > this->maxUsec) {
+			this->maxUsec = usec;
+		}
+	}
+
+	// inclusive upper bound of bucket in msec, -1 for the last one
+	static long long upperMsec(int bucket)
+	{
+		return bucket < BUCKETS - 1 ? 1LL << bucket : -1;
+	}
+
+	// upper bound in msec of the bucket which has the percentile, the
+	// max for the last bucket
+	long long percentileMsec(int percentile) const
+	{
+		if (this->count == 0) {
+			return 0;
+		}
+		long long rank = (this->count * percentile + 99) / 100;
+		long long seen = 0;
+		for (int i = 0; i < BUCKETS - 1; i++) {
+			seen += this->counts[i];
+			if (seen >= rank) {
+				return upperMsec(i);
+			}
+		}
+		return (this->maxUsec + 999) / 1000;
+	}
+
+	long long meanUsec() const
+	{
+		return this->count > 0 ? this->sumUsec / this->count : 0;
+	}
+};
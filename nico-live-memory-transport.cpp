@@ -0,0 +1,147 @@
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "nico-live-memory-transport.hpp"
+#include "nico-live-api.hpp"
+#include "nicolive.h"
+
+void NicoLiveMemoryTransport::setResponse(const std::string &url,
+	const Entry &entry)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->fixed[url] = std::make_shared<const Entry>(entry);
+}
+
+void NicoLiveMemoryTransport::pushResponse(const std::string &url,
+	const Entry &entry)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->queued[url].push_back(std::make_shared<const Entry>(entry));
+}
+
+void NicoLiveMemoryTransport::clear()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->fixed.clear();
+	this->queued.clear();
+	this->counts.clear();
+}
+
+long long NicoLiveMemoryTransport::requestCount(const std::string &url)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto found = this->counts.find(url);
+	return found == this->counts.end() ? 0 : found->second;
+}
+
+bool NicoLiveMemoryTransport::findEntry(const std::string &url,
+	std::shared_ptr<const Entry> *entry)
+{
+	if (this->findEntryOf(url, entry)) {
+		return true;
+	}
+	size_t query = url.find('?');
+	return query != std::string::npos &&
+		this->findEntryOf(url.substr(0, query), entry);
+}
+
+bool NicoLiveMemoryTransport::findEntryOf(const std::string &key,
+	std::shared_ptr<const Entry> *entry)
+{
+	auto queuedEntries = this->queued.find(key);
+	if (queuedEntries != this->queued.end() &&
+			!queuedEntries->second.empty()) {
+		*entry = queuedEntries->second.front();
+		queuedEntries->second.pop_front();
+		return true;
+	}
+	auto fixedEntry = this->fixed.find(key);
+	if (fixedEntry != this->fixed.end()) {
+		*entry = fixedEntry->second;
+		return true;
+	}
+	return false;
+}
+
+NicoLiveTransport::Result NicoLiveMemoryTransport::perform(
+	const NicoLiveRequest &request,
+	NicoLiveResponse *response,
+	NicoLiveMetrics *metrics)
+{
+	auto startTime = std::chrono::steady_clock::now();
+	static const Entry notFound = []() {
+		Entry entry;
+		entry.code = 404;
+		return entry;
+	}();
+	std::shared_ptr<const Entry> found;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto count = this->counts.find(request.url);
+		if (count != this->counts.end()) {
+			count->second++;
+		} else {
+			this->counts.emplace(request.url, 1);
+		}
+		if (!this->findEntry(request.url, &found)) {
+			nicolive_log_debug("no memory response: %s",
+				request.url.c_str());
+		}
+	}
+	const Entry &entry = found ? *found : notFound;
+
+	// wait for the latency as a network does
+	auto deadline = std::chrono::steady_clock::now() +
+		std::chrono::milliseconds(entry.latencyMsec);
+	auto timeout = std::chrono::steady_clock::now() +
+		std::chrono::milliseconds(request.timeoutMsec);
+	while (std::chrono::steady_clock::now() < deadline) {
+		if (request.canceled != nullptr && *request.canceled) {
+			return Result::CANCELED;
+		}
+		if (std::chrono::steady_clock::now() >= timeout) {
+			return Result::TIMEOUT;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(
+			std::min(entry.latencyMsec, 10LL)));
+	}
+
+	response->code = entry.code;
+	char status[32];
+	std::snprintf(status, sizeof(status), "HTTP/1.1 %d\r\n", entry.code);
+	response->header.assign(status);
+	response->header += entry.header;
+	response->header += "\r\n";
+	response->body.clear();
+	response->hedgeWon = false;
+	response->reused = true;
+	response->timing = NicoLiveTiming();
+	response->timing.startTransferUsec = response->timing.totalUsec =
+		std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - startTime).count();
+	if (!(request.completeHeader &&
+			request.completeHeader(entry.code))) {
+		response->body = entry.body;
+		if (request.completeBody) {
+			size_t keep = request.completeBody(response->body);
+			if (keep > 0 && keep < response->body.size()) {
+				response->body.resize(keep);
+				metrics->earlyCompletions++;
+			}
+		}
+	} else {
+		metrics->earlyCompletions++;
+	}
+	response->bodyHash = NicoLiveApi::hashString(NicoLiveApi::HASH_INIT,
+		response->body.c_str(), response->body.size());
+
+	metrics->requests++;
+	metrics->sentBytes += static_cast<long long>(
+		request.url.size() + request.postData.size());
+	metrics->receivedBytes += static_cast<long long>(
+		response->header.size() + response->body.size());
+	metrics->reusedConnections++;
+	return Result::OK;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "nico-live-transport.hpp"
+
+// Serves canned responses without network, for benchmarks and offline runs.
+// A queued response is served once before the fixed one of the same url.
+// The query string is ignored when no response is set for the full url.
+// Serving a fixed response of a url seen before does not allocate.
+class NicoLiveMemoryTransport : public NicoLiveTransport {
+public:
+	struct Entry {
+		int code = 200;
+		// header lines without the status line
+		std::string header;
+		std::string body;
+		long long latencyMsec = 0;
+	};
+private:
+	std::mutex mutex;
+	// shared with a perform in progress, not to be copied under the lock
+	std::unordered_map<std::string, std::shared_ptr<const Entry>> fixed;
+	std::unordered_map<std::string,
+		std::deque<std::shared_ptr<const Entry>>> queued;
+	std::unordered_map<std::string, long long> counts;
+public:
+	void setResponse(const std::string &url, const Entry &entry);
+	void pushResponse(const std::string &url, const Entry &entry);
+	void clear();
+	long long requestCount(const std::string &url);
+	Result perform(const NicoLiveRequest &request,
+		NicoLiveResponse *response, NicoLiveMetrics *metrics) override;
+private:
+	bool findEntry(const std::string &url,
+		std::shared_ptr<const Entry> *entry);
+	bool findEntryOf(const std::string &key,
+		std::shared_ptr<const Entry> *entry);
+};
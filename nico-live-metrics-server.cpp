@@ -0,0 +1,315 @@
+#include <string>
+#include <cstring>
+#include <ctime>
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+typedef SOCKET socket_t;
+#define close_socket closesocket
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#endif
+#include <util/bmem.h>
+#include <util/platform.h>
+#include "nico-live-metrics-server.hpp"
+#include "nicolive.h"
+
+void NicoLiveMetricsServer::appendHistogram(std::string *text,
+	const char *name, const std::string &labels,
+	const NicoLiveHistogram &histogram)
+{
+	std::string prefix = labels.empty() ? "{" : "{" + labels + ",";
+	long long cumulative = 0;
+	char line[256];
+	for (int i = 0; i < NicoLiveHistogram::BUCKETS - 1; i++) {
+		cumulative += histogram.counts[i];
+		std::snprintf(line, sizeof(line), "%s_bucket%sle=\"%g\"} %lld\n",
+			name, prefix.c_str(),
+			NicoLiveHistogram::upperMsec(i) / 1000.0, cumulative);
+		*text += line;
+	}
+	std::string suffix = labels.empty() ? "" : "{" + labels + "}";
+	std::snprintf(line, sizeof(line),
+		"%s_bucket%sle=\"+Inf\"} %lld\n%s_sum%s %.6f\n%s_count%s %lld\n",
+		name, prefix.c_str(), histogram.count,
+		name, suffix.c_str(), histogram.sumUsec / 1000000.0,
+		name, suffix.c_str(), histogram.count);
+	*text += line;
+}
+
+NicoLiveMetricsServer *NicoLiveMetricsServer::shared()
+{
+	static NicoLiveMetricsServer server;
+	return &server;
+}
+
+NicoLiveMetricsServer::NicoLiveMetricsServer() :
+	running(false), port(0)
+{
+}
+
+NicoLiveMetricsServer::~NicoLiveMetricsServer()
+{
+	this->stopListening();
+}
+
+bool NicoLiveMetricsServer::setPort(const void *source, int port)
+{
+	if (port <= 0) {
+		this->removeSource(source);
+		return true;
+	}
+	std::lock_guard<std::mutex> control(this->controlMutex);
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->sources[source].port = port;
+	}
+	if (this->running && port != this->port) {
+		nicolive_log_warn("metrics: move from port %d to %d",
+			this->port.load(), port);
+	}
+	return this->startListening(port);
+}
+
+void NicoLiveMetricsServer::removeSource(const void *source)
+{
+	std::lock_guard<std::mutex> control(this->controlMutex);
+	int nextPort = 0;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->sources.erase(source);
+		for (auto &entry: this->sources) {
+			if (entry.second.port == this->port) {
+				return;
+			}
+			nextPort = entry.second.port;
+		}
+	}
+	if (nextPort > 0) {
+		this->startListening(nextPort);
+	} else {
+		this->stopListening();
+	}
+}
+
+// must be called with the control lock
+bool NicoLiveMetricsServer::startListening(int port)
+{
+	if (port == this->port && this->running) {
+		return true;
+	}
+	this->stopListening();
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		nicolive_log_error("metrics: cannot start winsock");
+		return false;
+	}
+#endif
+	socket_t listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (listener == INVALID_SOCKET) {
+		nicolive_log_error("metrics: cannot create socket");
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR,
+		reinterpret_cast<const char *>(&reuse), sizeof(reuse));
+
+	// loopback only, the metrics are not for others
+	struct sockaddr_in address;
+	std::memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(static_cast<unsigned short>(port));
+	if (bind(listener, reinterpret_cast<struct sockaddr *>(&address),
+			sizeof(address)) != 0 || listen(listener, 4) != 0) {
+		nicolive_log_error("metrics: cannot listen on port %d", port);
+		close_socket(listener);
+#ifdef _WIN32
+		WSACleanup();
+#endif
+		return false;
+	}
+
+	nicolive_log_info("metrics: listen on 127.0.0.1:%d", port);
+	this->listener = static_cast<long long>(listener);
+	this->port = port;
+	this->running = true;
+	this->thread = std::thread(&NicoLiveMetricsServer::run, this);
+	return true;
+}
+
+// must be called with the control lock
+void NicoLiveMetricsServer::stopListening()
+{
+	if (!this->running) {
+		return;
+	}
+	this->running = false;
+	if (this->thread.joinable()) {
+		this->thread.join();
+	}
+	close_socket(static_cast<socket_t>(this->listener));
+	this->listener = -1;
+	this->port = 0;
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+int NicoLiveMetricsServer::getPort() const
+{
+	return this->port;
+}
+
+void NicoLiveMetricsServer::setSnapshot(const void *source,
+	const std::string &text, long long liveEndTime)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	auto found = this->sources.find(source);
+	if (found == this->sources.end()) {
+		return;
+	}
+	found->second.snapshot = text;
+	found->second.liveEndTime = liveEndTime;
+	found->second.updated = ++this->updates;
+}
+
+void NicoLiveMetricsServer::run()
+{
+	socket_t listener = static_cast<socket_t>(this->listener);
+	while (this->running) {
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		FD_SET(listener, &readSet);
+		struct timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = NicoLiveMetricsServer::POLL_MSEC * 1000;
+		// the first argument is ignored on Windows
+		if (select(static_cast<int>(listener) + 1, &readSet, nullptr,
+				nullptr, &timeout) <= 0) {
+			continue;
+		}
+		socket_t client = accept(listener, nullptr, nullptr);
+		if (client == INVALID_SOCKET) {
+			continue;
+		}
+		this->serve(static_cast<long long>(client));
+		close_socket(client);
+	}
+}
+
+void NicoLiveMetricsServer::serve(long long clientHandle)
+{
+	socket_t client = static_cast<socket_t>(clientHandle);
+#ifdef _WIN32
+	DWORD receiveTimeout = 1000;
+#else
+	struct timeval receiveTimeout;
+	receiveTimeout.tv_sec = 1;
+	receiveTimeout.tv_usec = 0;
+#endif
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO,
+		reinterpret_cast<const char *>(&receiveTimeout),
+		sizeof(receiveTimeout));
+
+	std::string request;
+	char buffer[512];
+	while (request.find("\r\n\r\n") == std::string::npos &&
+			request.size() < NicoLiveMetricsServer::MAX_REQUEST_SIZE) {
+		int received = static_cast<int>(
+			recv(client, buffer, sizeof(buffer), 0));
+		if (received <= 0) {
+			return;
+		}
+		request.append(buffer, static_cast<size_t>(received));
+	}
+
+	std::string status = "200 OK";
+	std::string body;
+	if (request.compare(0, 13, "GET /metrics ") == 0 ||
+			request.compare(0, 14, "GET /metrics?") == 0) {
+		body = this->render();
+	} else {
+		status = "404 Not Found";
+		body = "not found\n";
+	}
+	std::string response = "HTTP/1.1 " + status + "\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: " + std::to_string(body.size()) + "\r\n"
+		"Connection: close\r\n\r\n" + body;
+	size_t sent = 0;
+	while (sent < response.size()) {
+		int result = static_cast<int>(send(client,
+			response.c_str() + sent,
+			static_cast<int>(response.size() - sent), 0));
+		if (result <= 0) {
+			return;
+		}
+		sent += static_cast<size_t>(result);
+	}
+}
+
+std::string NicoLiveMetricsServer::render()
+{
+	std::string text;
+	long long endTime = 0;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		const Source *served = nullptr;
+		for (auto &entry: this->sources) {
+			const Source &source = entry.second;
+			if (source.port != this->port) {
+				continue;
+			}
+			bool onair = source.liveEndTime > 0;
+			bool servedOnair = served != nullptr &&
+				served->liveEndTime > 0;
+			if (served == nullptr || onair > servedOnair ||
+					(onair == servedOnair &&
+					source.updated > served->updated)) {
+				served = &source;
+			}
+		}
+		if (served != nullptr) {
+			text = served->snapshot;
+			endTime = served->liveEndTime;
+		}
+	}
+
+	long long remaining = 0;
+	if (endTime > 0) {
+		remaining = endTime - static_cast<long long>(
+			std::time(nullptr));
+		if (remaining < 0) {
+			remaining = 0;
+		}
+	}
+	text += "# HELP nicolive_remaining_live_seconds "
+		"Remaining time of the live on air.\n"
+		"# TYPE nicolive_remaining_live_seconds gauge\n"
+		"nicolive_remaining_live_seconds " +
+		std::to_string(remaining) + "\n";
+	text += "# HELP nicolive_resident_memory_bytes "
+		"Resident memory of the OBS process.\n"
+		"# TYPE nicolive_resident_memory_bytes gauge\n"
+		"nicolive_resident_memory_bytes " +
+		std::to_string(os_get_proc_resident_size()) + "\n";
+	text += "# HELP nicolive_obs_allocations "
+		"Live allocations of the OBS allocator.\n"
+		"# TYPE nicolive_obs_allocations gauge\n"
+		"nicolive_obs_allocations " +
+		std::to_string(bnum_allocs()) + "\n";
+	return text;
+}
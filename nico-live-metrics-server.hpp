@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include "nico-live-histogram.hpp"
+
+// Serves GET /metrics in the Prometheus text format on 127.0.0.1.
+// One server is shared by the process, since a port is bound only once.
+// Each source, a NicoLive, renders its counters into a snapshot on its own
+// thread; the server serves the snapshot of the source on air, or else the
+// latest one, and adds the remaining live time and the process memory per
+// scrape.
+class NicoLiveMetricsServer {
+public:
+	static const int MAX_REQUEST_SIZE = 4096;
+	static const int POLL_MSEC = 200;
+	// "name{labels}" lines of a histogram in seconds
+	static void appendHistogram(std::string *text, const char *name,
+		const std::string &labels, const NicoLiveHistogram &histogram);
+private:
+	struct Source {
+		int port = 0;
+		std::string snapshot;
+		long long liveEndTime = 0;
+		unsigned long long updated = 0;
+	};
+	std::mutex mutex;
+	std::unordered_map<const void *, Source> sources;
+	unsigned long long updates = 0;
+	// serializes listen and close with the sources
+	std::mutex controlMutex;
+	std::atomic<bool> running;
+	std::thread thread;
+	long long listener = -1; // SOCKET or int
+	std::atomic<int> port;
+public:
+	static NicoLiveMetricsServer *shared();
+	NicoLiveMetricsServer();
+	~NicoLiveMetricsServer();
+	// listen on the loopback port for source, port 0 removes the source
+	// and the last source to leave stops the server; if sources ask for
+	// different ports, the latest one is listened on
+	bool setPort(const void *source, int port);
+	void removeSource(const void *source);
+	// the port listened on, 0 if stopped
+	int getPort() const;
+	// liveEndTime is the unix time of the live end, 0 if off air
+	void setSnapshot(const void *source, const std::string &text,
+		long long liveEndTime);
+private:
+	bool startListening(int port);
+	void stopListening();
+	void run();
+	void serve(long long client);
+	std::string render();
+};
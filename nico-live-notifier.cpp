@@ -0,0 +1,89 @@
+#include <QtCore>
+#include <QtWidgets>
+#include <obs-module.h>
+#include "nicolive.h"
+#include "nico-live-notifier.hpp"
+
+NicoLiveNotifier::NicoLiveNotifier(QWidget *parentWidget, QObject *parent) :
+	QObject(parent),
+	parentWidget(parentWidget)
+{
+	this->timer = new QTimer(this);
+	this->timer->setSingleShot(true);
+	connect(timer, SIGNAL(timeout()), this, SLOT(showNext()));
+}
+
+NicoLiveNotifier::~NicoLiveNotifier()
+{
+	if (!this->box.isNull())
+		this->box->deleteLater();
+}
+
+void NicoLiveNotifier::post(Level level, const QString &message)
+{
+	QDateTime now = QDateTime::currentDateTimeUtc();
+	{
+		QMutexLocker locker(&this->mutex);
+		auto found = this->recent.find(message);
+		if (found != this->recent.end() &&
+				found.value().msecsTo(now) < DUPLICATE_MSEC) {
+			nicolive_log_debug("drop duplicate notice");
+			return;
+		}
+		if (this->queue.size() >= MAX_QUEUE) {
+			nicolive_log_warn("notice queue is full, drop notice");
+			return;
+		}
+		this->recent.insert(message, now);
+		this->queue.enqueue(Notice{level, message});
+	}
+	QMetaObject::invokeMethod(this, "showNext", Qt::QueuedConnection);
+}
+
+void NicoLiveNotifier::showNext()
+{
+	if (!this->box.isNull() || this->timer->isActive())
+		return;
+
+	Notice notice;
+	{
+		QMutexLocker locker(&this->mutex);
+		if (this->queue.isEmpty())
+			return;
+		notice = this->queue.dequeue();
+
+		QDateTime now = QDateTime::currentDateTimeUtc();
+		for (auto it = this->recent.begin();
+				it != this->recent.end(); ) {
+			if (it.value().msecsTo(now) >= DUPLICATE_MSEC)
+				it = this->recent.erase(it);
+			else
+				++it;
+		}
+	}
+
+	QMessageBox::Icon icon;
+	const char *title;
+	switch (notice.level) {
+	case Level::CRITICAL:
+		icon = QMessageBox::Critical;
+		title = "MessageTitleError";
+		break;
+	case Level::WARNING:
+		icon = QMessageBox::Warning;
+		title = "MessageTitleWarn";
+		break;
+	default:
+		icon = QMessageBox::Information;
+		title = "MessageTitleInfo";
+	}
+
+	this->box = new QMessageBox(icon, QString(obs_module_text(title)),
+		notice.message, QMessageBox::Ok, this->parentWidget);
+	this->box->setAttribute(Qt::WA_DeleteOnClose);
+	this->box->setWindowModality(Qt::NonModal);
+	connect(this->box, &QMessageBox::finished, this, [this](int) {
+		this->timer->start(MIN_INTERVAL_MSEC);
+	});
+	this->box->show();
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QtCore>
+#include <QtWidgets>
+
+// Non-modal, rate-limited and de-duplicated message boxes.
+// post() is thread-safe and never blocks; boxes are shown one at a time on
+// the thread that owns the notifier (the GUI thread).
+class NicoLiveNotifier : public QObject {
+	Q_OBJECT
+public:
+	enum class Level {
+		CRITICAL,
+		WARNING,
+		INFORMATION,
+	};
+	static const int MIN_INTERVAL_MSEC = 3 * 1000; // 3s
+	static const int DUPLICATE_MSEC = 60 * 1000; // 1min
+	static const int MAX_QUEUE = 8;
+private:
+	struct Notice {
+		Level level;
+		QString message;
+	};
+	QMutex mutex;
+	QQueue<Notice> queue;
+	QHash<QString, QDateTime> recent;
+	QPointer<QMessageBox> box;
+	QTimer *timer;
+	QWidget *parentWidget;
+public:
+	NicoLiveNotifier(QWidget *parentWidget = nullptr,
+		QObject *parent = nullptr);
+	~NicoLiveNotifier();
+	void post(Level level, const QString &message);
+private slots:
+	void showNext();
+};
@@ -0,0 +1,317 @@
+#include <chrono>
+#include <cstdio>
+#include <obs.h>
+#include "nicolive.h"
+#include "nico-live-output-sampler.hpp"
+
+NicoLiveOutputSampler::NicoLiveOutputSampler()
+{
+	this->ring.reserve(NicoLiveOutputSampler::CAPACITY);
+}
+
+NicoLiveOutputSampler::~NicoLiveOutputSampler()
+{
+	this->stop();
+	obs_weak_output_release(this->output);
+}
+
+void NicoLiveOutputSampler::setOutput(obs_output_t *output)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	obs_weak_output_release(this->output);
+	this->output = output != nullptr ?
+		obs_output_get_weak_output(output) : nullptr;
+}
+
+void NicoLiveOutputSampler::start(const std::string &liveId)
+{
+	this->stop();
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->ring.clear();
+	this->next = 0;
+	this->summary = Summary();
+	this->summary.liveId = liveId;
+	this->first = Sample();
+	this->adapting = this->adaptive;
+	// the cap of this live is the encoder bitrate at the first sample
+	this->controller.reset(0);
+	this->running = true;
+	this->thread = std::thread(&NicoLiveOutputSampler::run, this);
+}
+
+void NicoLiveOutputSampler::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (!this->running)
+			return;
+		this->running = false;
+	}
+	this->cond.notify_all();
+	this->thread.join();
+	this->logSummary(this->getSummary());
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	NicoLiveBitrateController::Stats stats = this->controller.getStats();
+	// adapting, not adaptive, which may have been toggled since start()
+	if (this->adapting && stats.kbps != stats.capKbps) {
+		// the encoder settings are saved, so do not leave them lowered
+		obs_output_t *output =
+			obs_weak_output_get_output(this->output);
+		if (output != nullptr) {
+			setVideoBitrate(output, stats.capKbps);
+			obs_output_release(output);
+			nicolive_log_info("bitrate: restore %lld kbps",
+				stats.capKbps);
+		}
+	}
+	this->controller.reset(stats.capKbps);
+	this->adapting = false;
+}
+
+bool NicoLiveOutputSampler::isRunning()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->running;
+}
+
+std::vector<NicoLiveOutputSampler::Sample> NicoLiveOutputSampler::getSamples()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	std::vector<Sample> samples;
+	samples.reserve(this->ring.size());
+	if (this->ring.size() < NicoLiveOutputSampler::CAPACITY) {
+		samples = this->ring;
+	} else {
+		samples.insert(samples.end(),
+			this->ring.begin() + this->next, this->ring.end());
+		samples.insert(samples.end(),
+			this->ring.begin(), this->ring.begin() + this->next);
+	}
+	return samples;
+}
+
+void NicoLiveOutputSampler::setEnabledAdaptiveBitrate(bool enabled)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->adaptive = enabled;
+}
+
+bool NicoLiveOutputSampler::enabledAdaptiveBitrate()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->adaptive;
+}
+
+void NicoLiveOutputSampler::setAdjustedCallback(
+	const std::function<void()> &callback)
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	this->adjusted = callback;
+}
+
+NicoLiveBitrateController::Stats NicoLiveOutputSampler::getBitrateStats()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->controller.getStats();
+}
+
+NicoLiveOutputSampler::Summary NicoLiveOutputSampler::getSummary()
+{
+	std::lock_guard<std::mutex> lock(this->mutex);
+	return this->summary;
+}
+
+void NicoLiveOutputSampler::run()
+{
+	const std::chrono::milliseconds interval(static_cast<int>(
+		NicoLiveOutputSampler::INTERVAL_MSEC));
+	auto start = std::chrono::steady_clock::now();
+	auto wakeup = start;
+	std::unique_lock<std::mutex> lock(this->mutex);
+	while (this->running) {
+		wakeup += interval;
+		this->cond.wait_until(lock, wakeup,
+			[this]() { return !this->running; });
+		long long msec = std::chrono::duration_cast<
+			std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+		// the last sample is taken on stop too
+		if (!this->sample(msec))
+			break;
+	}
+}
+
+// must be called with the lock
+bool NicoLiveOutputSampler::sample(long long msec)
+{
+	obs_output_t *output = obs_weak_output_get_output(this->output);
+	if (output == nullptr)
+		return false;
+
+	Sample current;
+	current.msec = msec;
+	current.totalBytes = obs_output_get_total_bytes(output);
+	current.totalFrames = obs_output_get_total_frames(output);
+	current.droppedFrames = obs_output_get_frames_dropped(output);
+	current.congestion = obs_output_get_congestion(output);
+	current.connectTimeMsec = obs_output_get_connect_time_ms(output);
+	video_t *video = obs_get_video();
+	if (video != nullptr) {
+		current.videoFrames = video_output_get_total_frames(video);
+		current.skippedFrames = video_output_get_skipped_frames(video);
+	}
+
+	if (this->summary.samples == 0) {
+		this->first = current;
+		if (this->adapting)
+			this->controller.reset(getVideoBitrate(output));
+	}
+
+	Sample previous = this->first;
+	if (!this->ring.empty()) {
+		size_t last = (this->next + NicoLiveOutputSampler::CAPACITY - 1)
+			% NicoLiveOutputSampler::CAPACITY;
+		previous = this->ring[last];
+	}
+	if (current.msec > previous.msec &&
+			current.totalBytes >= previous.totalBytes) {
+		long long kbps = static_cast<long long>(
+			(current.totalBytes - previous.totalBytes) * 8 /
+			(current.msec - previous.msec));
+		if (kbps > this->summary.peakKbps)
+			this->summary.peakKbps = kbps;
+	}
+	if (this->adapting && this->summary.samples > 0)
+		this->adaptBitrate(output, previous, current);
+	obs_output_release(output);
+
+	if (this->ring.size() < NicoLiveOutputSampler::CAPACITY)
+		this->ring.push_back(current);
+	else
+		this->ring[this->next] = current;
+	this->next = (this->next + 1) % NicoLiveOutputSampler::CAPACITY;
+
+	Summary &s = this->summary;
+	s.durationMsec = current.msec;
+	s.samples++;
+	s.bytes = current.totalBytes - this->first.totalBytes;
+	s.totalFrames = current.totalFrames - this->first.totalFrames;
+	s.droppedFrames = current.droppedFrames - this->first.droppedFrames;
+	s.congestionSum += current.congestion;
+	if (current.congestion > s.congestionMax)
+		s.congestionMax = current.congestion;
+	s.connectTimeMsec = current.connectTimeMsec;
+	s.videoFrames = current.videoFrames - this->first.videoFrames;
+	s.skippedFrames = current.skippedFrames - this->first.skippedFrames;
+	return true;
+}
+
+// must be called with the lock
+void NicoLiveOutputSampler::adaptBitrate(obs_output_t *output,
+	const Sample &previous, const Sample &current)
+{
+	long long before = this->controller.getKbps();
+	if (!this->controller.update(current.congestion,
+			current.totalFrames - previous.totalFrames,
+			current.droppedFrames - previous.droppedFrames))
+		return;
+
+	long long after = this->controller.getKbps();
+	setVideoBitrate(output, after);
+	char beforeKbps[24];
+	char afterKbps[24];
+	char congestion[24];
+	std::snprintf(beforeKbps, sizeof(beforeKbps), "%lld", before);
+	std::snprintf(afterKbps, sizeof(afterKbps), "%lld", after);
+	std::snprintf(congestion, sizeof(congestion), "%.2f",
+		current.congestion);
+	nicolive_log_fields(LOG_INFO, "bitrate",
+		"from_kbps", beforeKbps, "to_kbps", afterKbps,
+		"reason", NicoLiveBitrateController::reasonName(
+			this->controller.getLastReason()),
+		"congestion", congestion);
+	if (this->adjusted)
+		this->adjusted();
+}
+
+long long NicoLiveOutputSampler::getVideoBitrate(obs_output_t *output)
+{
+	obs_encoder_t *encoder = obs_output_get_video_encoder(output);
+	if (encoder == nullptr)
+		return 0;
+	obs_data_t *settings = obs_encoder_get_settings(encoder);
+	long long kbps = obs_data_get_int(settings, "bitrate");
+	obs_data_release(settings);
+	return kbps;
+}
+
+void NicoLiveOutputSampler::setVideoBitrate(obs_output_t *output,
+	long long kbps)
+{
+	obs_encoder_t *encoder = obs_output_get_video_encoder(output);
+	if (encoder == nullptr)
+		return;
+	obs_data_t *settings = obs_encoder_get_settings(encoder);
+	obs_data_set_int(settings, "bitrate", kbps);
+	obs_encoder_update(encoder, settings);
+	obs_data_release(settings);
+}
+
+void NicoLiveOutputSampler::logSummary(const Summary &summary)
+{
+	if (summary.samples == 0) {
+		nicolive_log_fields(LOG_INFO, "broadcast summary",
+			"live_id", summary.liveId.c_str(), "samples", "0");
+		return;
+	}
+	long long avgKbps = summary.durationMsec > 0 ?
+		static_cast<long long>(summary.bytes * 8 /
+			summary.durationMsec) : 0;
+	double dropPercent = summary.totalFrames > 0 ?
+		100.0 * summary.droppedFrames / summary.totalFrames : 0.0;
+	// the numbers as the values of fields
+	char duration[24];
+	char bytes[24];
+	char avg[24];
+	char peak[24];
+	char dropped[24];
+	char total[24];
+	char dropRate[24];
+	char skipped[24];
+	char videoFrames[24];
+	char congestionMean[24];
+	char congestionMax[24];
+	char connect[24];
+	std::snprintf(duration, sizeof(duration), "%lld",
+		summary.durationMsec / 1000);
+	std::snprintf(bytes, sizeof(bytes), "%llu", summary.bytes);
+	std::snprintf(avg, sizeof(avg), "%lld", avgKbps);
+	std::snprintf(peak, sizeof(peak), "%lld", summary.peakKbps);
+	std::snprintf(dropped, sizeof(dropped), "%d", summary.droppedFrames);
+	std::snprintf(total, sizeof(total), "%d", summary.totalFrames);
+	std::snprintf(dropRate, sizeof(dropRate), "%.2f", dropPercent);
+	std::snprintf(skipped, sizeof(skipped), "%lld", summary.skippedFrames);
+	std::snprintf(videoFrames, sizeof(videoFrames), "%lld",
+		summary.videoFrames);
+	std::snprintf(congestionMean, sizeof(congestionMean), "%.3f",
+		summary.congestionSum / summary.samples);
+	std::snprintf(congestionMax, sizeof(congestionMax), "%.3f",
+		summary.congestionMax);
+	std::snprintf(connect, sizeof(connect), "%d",
+		summary.connectTimeMsec);
+	nicolive_log_fields(LOG_INFO, "broadcast summary",
+		"live_id", summary.liveId.c_str(),
+		"duration_s", duration,
+		"bytes", bytes,
+		"avg_kbps", avg,
+		"peak_kbps", peak,
+		"dropped_frames", dropped,
+		"total_frames", total,
+		"dropped_percent", dropRate,
+		"skipped_frames", skipped,
+		"video_frames", videoFrames,
+		"congestion_mean", congestionMean,
+		"congestion_max", congestionMax,
+		"connect_ms", connect);
+}
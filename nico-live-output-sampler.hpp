@@ -0,0 +1,86 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <obs.h>
+#include "nico-live-bitrate-controller.hpp"
+
+// Samples the statistics of the streaming output on its own thread while
+// on air, keeps the latest samples in a fixed ring buffer and logs a
+// summary of the broadcast when stopped. With the adaptive bitrate, each
+// sample also drives the video encoder bitrate under the cap.
+class NicoLiveOutputSampler {
+public:
+	static const int INTERVAL_MSEC = 1000;
+	static const int CAPACITY = 600; // 10 minutes
+	struct Sample {
+		long long msec = 0; // since start
+		unsigned long long totalBytes = 0;
+		int totalFrames = 0;
+		int droppedFrames = 0;
+		float congestion = 0.0f;
+		int connectTimeMsec = 0;
+		// of the video output, skipped for encoding lag
+		unsigned int videoFrames = 0;
+		unsigned int skippedFrames = 0;
+	};
+	struct Summary {
+		std::string liveId;
+		long long durationMsec = 0;
+		long long samples = 0;
+		unsigned long long bytes = 0;
+		long long peakKbps = 0;
+		int totalFrames = 0;
+		int droppedFrames = 0;
+		double congestionSum = 0.0;
+		float congestionMax = 0.0f;
+		int connectTimeMsec = 0;
+		long long videoFrames = 0;
+		long long skippedFrames = 0;
+	};
+private:
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::thread thread;
+	bool running = false;
+	obs_weak_output_t *output = nullptr;
+	std::vector<Sample> ring;
+	size_t next = 0; // ring index of the next sample
+	Summary summary;
+	Sample first;
+	bool adaptive = false;
+	// adaptive latched at start(), for the whole broadcast
+	bool adapting = false;
+	NicoLiveBitrateController controller;
+	std::function<void()> adjusted;
+public:
+	NicoLiveOutputSampler();
+	~NicoLiveOutputSampler();
+	// keeps a weak reference, the output is sampled after start()
+	void setOutput(obs_output_t *output);
+	void start(const std::string &liveId);
+	// stop sampling and log the summary
+	void stop();
+	bool isRunning();
+	// takes effect from the next start()
+	void setEnabledAdaptiveBitrate(bool enabled);
+	bool enabledAdaptiveBitrate();
+	// called on the sampler thread after the bitrate changed
+	void setAdjustedCallback(const std::function<void()> &callback);
+	NicoLiveBitrateController::Stats getBitrateStats();
+	// the samples in the ring, oldest first
+	std::vector<Sample> getSamples();
+	Summary getSummary();
+private:
+	void run();
+	bool sample(long long msec);
+	void adaptBitrate(obs_output_t *output, const Sample &previous,
+		const Sample &current);
+	static long long getVideoBitrate(obs_output_t *output);
+	static void setVideoBitrate(obs_output_t *output, long long kbps);
+	void logSummary(const Summary &summary);
+};
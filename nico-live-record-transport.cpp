@@ -0,0 +1,188 @@
+#include <string>
+#include <chrono>
+#include <cstring>
+#include "nico-live-record-transport.hpp"
+#include "nico-live-api.hpp"
+#include "nicolive.h"
+
+// static
+const std::string NicoLiveRecordTransport::FILE_MAGIC =
+	"NICOLIVE-TRAFFIC 1\n";
+const std::string NicoLiveRecordTransport::REDACTED = "REDACTED";
+
+static bool isSecretName(const char *name, size_t length)
+{
+	static const char *const secretNames[] = {
+		"mail", "password", "ticket", "user_session", nullptr,
+	};
+	for (auto secret = secretNames; *secret != nullptr; secret++) {
+		if (std::strlen(*secret) == length &&
+				std::strncmp(*secret, name, length) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// "a=1&mail=x" -> "a=1&mail=REDACTED"
+std::string NicoLiveRecordTransport::redactQuery(const std::string &query)
+{
+	std::string redacted;
+	size_t begin = 0;
+	while (begin <= query.size()) {
+		size_t end = query.find('&', begin);
+		if (end == std::string::npos) {
+			end = query.size();
+		}
+		if (begin > 0) {
+			redacted += '&';
+		}
+		size_t equal = query.find('=', begin);
+		if (equal != std::string::npos && equal < end &&
+				isSecretName(query.c_str() + begin,
+					equal - begin)) {
+			redacted.append(query, begin, equal + 1 - begin);
+			redacted += NicoLiveRecordTransport::REDACTED;
+		} else {
+			redacted.append(query, begin, end - begin);
+		}
+		begin = end + 1;
+	}
+	return redacted;
+}
+
+// Values of Set-Cookie lines, as <name>_REDACTED. The value keeps the
+// prefix of a user_session value, which login checks.
+std::string NicoLiveRecordTransport::redactHeader(const std::string &header)
+{
+	std::string redacted;
+	size_t lineBegin = 0;
+	while (lineBegin < header.size()) {
+		size_t lineEnd = header.find('\n', lineBegin);
+		if (lineEnd == std::string::npos) {
+			lineEnd = header.size() - 1;
+		}
+		const char *line = header.c_str() + lineBegin;
+		size_t lineLength = lineEnd + 1 - lineBegin;
+		size_t begin;
+		size_t end;
+		const char *equal = nullptr;
+		if (NicoLiveApi::headerValue(line, lineLength, "Set-Cookie",
+				&begin, &end)) {
+			equal = static_cast<const char *>(
+				std::memchr(line + begin, '=', end - begin));
+		}
+		if (equal != nullptr) {
+			const char *semicolon = static_cast<const char *>(
+				std::memchr(equal, ';', line + end - equal));
+			if (semicolon == nullptr) {
+				semicolon = line + end;
+			}
+			redacted.append(line, equal + 1 - line);
+			redacted.append(line + begin, equal - (line + begin));
+			redacted += '_';
+			redacted += NicoLiveRecordTransport::REDACTED;
+			redacted.append(semicolon, line + lineLength - semicolon);
+		} else {
+			redacted.append(line, lineLength);
+		}
+		lineBegin = lineEnd + 1;
+	}
+	return redacted;
+}
+
+// text of <ticket> elements
+std::string NicoLiveRecordTransport::redactBody(const std::string &body)
+{
+	static const std::string openTag = "<ticket>";
+	static const std::string closeTag = "</ticket>";
+	std::string redacted;
+	size_t begin = 0;
+	for (;;) {
+		size_t open = body.find(openTag, begin);
+		if (open == std::string::npos) {
+			break;
+		}
+		size_t close = body.find(closeTag, open);
+		if (close == std::string::npos) {
+			break;
+		}
+		redacted.append(body, begin, open + openTag.size() - begin);
+		redacted += NicoLiveRecordTransport::REDACTED;
+		begin = close;
+	}
+	redacted.append(body, begin, std::string::npos);
+	return redacted;
+}
+
+std::string NicoLiveRecordTransport::redactUrl(const std::string &url)
+{
+	size_t question = url.find('?');
+	if (question == std::string::npos) {
+		return url;
+	}
+	return url.substr(0, question + 1) +
+		NicoLiveRecordTransport::redactQuery(url.substr(question + 1));
+}
+
+// instance
+NicoLiveRecordTransport::NicoLiveRecordTransport(NicoLiveTransport *inner,
+	const std::string &path) :
+	inner(inner),
+	file(path, std::ios::binary | std::ios::trunc),
+	startTime(std::chrono::steady_clock::now())
+{
+	if (!this->file) {
+		nicolive_log_error("cannot open traffic log: %s", path.c_str());
+		return;
+	}
+	nicolive_log_info("record traffic to %s", path.c_str());
+	this->file << NicoLiveRecordTransport::FILE_MAGIC;
+	this->file.flush();
+}
+
+bool NicoLiveRecordTransport::isOpen() const
+{
+	return this->file.is_open() && this->file.good();
+}
+
+NicoLiveTransport::Result NicoLiveRecordTransport::perform(
+	const NicoLiveRequest &request,
+	NicoLiveResponse *response,
+	NicoLiveMetrics *metrics)
+{
+	auto requestTime = std::chrono::steady_clock::now();
+	Result result = this->inner->perform(request, response, metrics);
+	auto responseTime = std::chrono::steady_clock::now();
+
+	std::string url = redactUrl(request.url);
+	std::string postData = request.post ?
+		NicoLiveRecordTransport::redactQuery(request.postData) :
+		std::string();
+	std::string header;
+	std::string body;
+	if (result == Result::OK) {
+		header = NicoLiveRecordTransport::redactHeader(
+			response->header);
+		body = NicoLiveRecordTransport::redactBody(response->body);
+	}
+
+	std::lock_guard<std::mutex> lock(this->mutex);
+	if (!this->isOpen()) {
+		return result;
+	}
+	this->file
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(
+			requestTime - this->startTime).count() << ' '
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(
+			responseTime - requestTime).count() << ' '
+		<< static_cast<int>(result) << ' '
+		<< (result == Result::OK ? response->code : 0) << ' '
+		<< (request.post ? 'P' : 'G') << ' '
+		<< url.size() << ' ' << postData.size() << ' '
+		<< header.size() << ' ' << body.size() << '\n'
+		<< url << postData << header << body << '\n';
+	// keep the log usable when OBS crashes
+	this->file.flush();
+	return result;
+}
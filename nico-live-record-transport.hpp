@@ -0,0 +1,37 @@
+#pragma once
+
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "nico-live-transport.hpp"
+
+// Passes requests to another transport and appends each pair to a log.
+// Credentials are redacted and the request cookie is not written.
+//
+// The log starts with FILE_MAGIC, then per access a line of
+// "<start msec> <elapsed msec> <result> <code> <G|P> <url length>
+// <post length> <header length> <body length>" followed by the raw
+// url, post data, response header and body, and a newline.
+class NicoLiveRecordTransport : public NicoLiveTransport {
+public:
+	static const std::string FILE_MAGIC;
+	static const std::string REDACTED;
+	static std::string redactQuery(const std::string &query);
+	static std::string redactUrl(const std::string &url);
+	static std::string redactHeader(const std::string &header);
+	static std::string redactBody(const std::string &body);
+private:
+	std::unique_ptr<NicoLiveTransport> inner;
+	std::mutex mutex;
+	std::ofstream file;
+	std::chrono::steady_clock::time_point startTime;
+public:
+	// takes ownership of inner
+	NicoLiveRecordTransport(NicoLiveTransport *inner,
+		const std::string &path);
+	bool isOpen() const;
+	Result perform(const NicoLiveRequest &request,
+		NicoLiveResponse *response, NicoLiveMetrics *metrics) override;
+};
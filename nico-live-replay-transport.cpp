@@ -0,0 +1,174 @@
+#include <string>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include "nico-live-replay-transport.hpp"
+#include "nico-live-record-transport.hpp"
+#include "nico-live-api.hpp"
+#include "nicolive.h"
+
+static bool readBytes(std::istream &stream, size_t length, std::string *str)
+{
+	str->resize(length);
+	if (length > 0) {
+		stream.read(&(*str)[0], static_cast<std::streamsize>(length));
+	}
+	return static_cast<size_t>(stream.gcount()) == length || length == 0;
+}
+
+NicoLiveReplayTransport::NicoLiveReplayTransport(const std::string &path,
+	bool timed) : timed(timed)
+{
+	if (this->load(path)) {
+		nicolive_log_info("replay %zu accesses from %s%s",
+			this->records.size(), path.c_str(),
+			timed ? " in time" : "");
+	} else {
+		nicolive_log_error("cannot load traffic log: %s",
+			path.c_str());
+	}
+}
+
+bool NicoLiveReplayTransport::load(const std::string &path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	std::string magic;
+	if (!readBytes(file, NicoLiveRecordTransport::FILE_MAGIC.size(),
+			&magic) || magic != NicoLiveRecordTransport::FILE_MAGIC) {
+		return false;
+	}
+
+	for (std::string line; std::getline(file, line); ) {
+		if (line.empty()) {
+			continue;
+		}
+		Record record;
+		int result = 0;
+		char method = 'G';
+		size_t urlLength = 0;
+		size_t postLength = 0;
+		size_t headerLength = 0;
+		size_t bodyLength = 0;
+		std::istringstream stream(line);
+		stream >> record.startMsec >> record.elapsedMsec >> result
+			>> record.code >> method >> urlLength >> postLength
+			>> headerLength >> bodyLength;
+		if (!stream || result < static_cast<int>(Result::OK) ||
+				result > static_cast<int>(Result::TIMEOUT)) {
+			nicolive_log_warn("broken traffic log line: %s",
+				line.c_str());
+			return !this->records.empty();
+		}
+		record.result = static_cast<Result>(result);
+		record.post = method == 'P';
+		if (!readBytes(file, urlLength, &record.url) ||
+				!readBytes(file, postLength, &record.postData) ||
+				!readBytes(file, headerLength, &record.header) ||
+				!readBytes(file, bodyLength, &record.body)) {
+			nicolive_log_warn("truncated traffic log");
+			break;
+		}
+		this->records.push_back(record);
+	}
+	return true;
+}
+
+size_t NicoLiveReplayTransport::recordCount() const
+{
+	return this->records.size();
+}
+
+// false if canceled or timed out before until
+static bool waitUntil(std::chrono::steady_clock::time_point until,
+	const NicoLiveRequest &request, NicoLiveTransport::Result *result)
+{
+	auto timeout = std::chrono::steady_clock::now() +
+		std::chrono::milliseconds(request.timeoutMsec);
+	while (std::chrono::steady_clock::now() < until) {
+		if (request.canceled != nullptr && *request.canceled) {
+			*result = NicoLiveTransport::Result::CANCELED;
+			return false;
+		}
+		if (std::chrono::steady_clock::now() >= timeout) {
+			*result = NicoLiveTransport::Result::TIMEOUT;
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	return true;
+}
+
+NicoLiveTransport::Result NicoLiveReplayTransport::perform(
+	const NicoLiveRequest &request,
+	NicoLiveResponse *response,
+	NicoLiveMetrics *metrics)
+{
+	std::string url = NicoLiveRecordTransport::redactUrl(request.url);
+
+	auto requestTime = std::chrono::steady_clock::now();
+	Record record;
+	std::chrono::steady_clock::time_point startTime;
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto found = std::find_if(
+			this->records.begin() + this->next,
+			this->records.end(),
+			[&](const Record &candidate) {
+				return candidate.post == request.post &&
+					candidate.url == url;
+			});
+		if (found == this->records.end()) {
+			nicolive_log_warn("no more recorded access: %s",
+				url.c_str());
+			response->error = "no more recorded access";
+			return Result::FAILED;
+		}
+		record = *found;
+		this->next = found - this->records.begin() + 1;
+		if (!this->started) {
+			// the first request defines the start of the log
+			this->started = true;
+			this->startTime = std::chrono::steady_clock::now() -
+				std::chrono::milliseconds(record.startMsec);
+		}
+		startTime = this->startTime;
+	}
+
+	if (this->timed) {
+		Result result;
+		auto recordedTime = std::max(std::chrono::steady_clock::now(),
+			startTime + std::chrono::milliseconds(
+				record.startMsec));
+		if (!waitUntil(recordedTime + std::chrono::milliseconds(
+				record.elapsedMsec), request, &result)) {
+			return result;
+		}
+	}
+
+	metrics->requests++;
+	if (record.result != Result::OK) {
+		response->error = "recorded failure";
+		return record.result;
+	}
+	response->code = record.code;
+	response->header = record.header;
+	response->body = record.body;
+	response->bodyHash = NicoLiveApi::hashString(NicoLiveApi::HASH_INIT,
+		response->body.c_str(), response->body.size());
+	response->hedgeWon = false;
+	response->reused = true;
+	response->timing = NicoLiveTiming();
+	response->timing.startTransferUsec = response->timing.totalUsec =
+		std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - requestTime).count();
+	metrics->sentBytes += static_cast<long long>(
+		request.url.size() + request.postData.size());
+	metrics->receivedBytes += static_cast<long long>(
+		response->header.size() + response->body.size());
+	return Result::OK;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "nico-live-transport.hpp"
+
+// Serves a log of NicoLiveRecordTransport back. Each request gets the
+// next recorded access of the same method and url. When timed, requests
+// wait until the recorded start and for the recorded elapsed time.
+class NicoLiveReplayTransport : public NicoLiveTransport {
+	struct Record {
+		long long startMsec = 0;
+		long long elapsedMsec = 0;
+		Result result = Result::OK;
+		int code = 0;
+		bool post = false;
+		std::string url;
+		std::string postData;
+		std::string header;
+		std::string body;
+	};
+private:
+	bool timed;
+	std::mutex mutex;
+	std::vector<Record> records;
+	size_t next = 0;
+	bool started = false;
+	std::chrono::steady_clock::time_point startTime;
+public:
+	NicoLiveReplayTransport(const std::string &path, bool timed);
+	size_t recordCount() const;
+	Result perform(const NicoLiveRequest &request,
+		NicoLiveResponse *response, NicoLiveMetrics *metrics) override;
+private:
+	bool load(const std::string &path);
+};
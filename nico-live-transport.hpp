@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// counters of web accesses, sizes include headers
+struct NicoLiveMetrics {
+	long long requests = 0;
+	long long sentBytes = 0;
+	long long receivedBytes = 0;
+	long long reusedConnections = 0;
+	long long handshakes = 0;
+	long long handshakeUsec = 0;
+	long long cacheHits = 0;
+	long long cacheRevalidated = 0;
+	// growth of the reusable response buffers
+	long long bufferAllocations = 0;
+	long long earlyCompletions = 0;
+};
+
+struct NicoLiveRequest {
+	std::string url;
+	bool post = false;
+	std::string postData;
+	std::string cookie;
+	// extra "Name: value" lines
+	std::vector<std::string> headers;
+	long long timeoutMsec = 0;
+	// send a duplicate after hedgeMsec, 0 for no duplicate
+	long long hedgeMsec = 0;
+	// Stop the transfer when all needed data has arrived.
+	// completeHeader gets the status code at the end of headers,
+	// completeBody gets the body so far and returns the length to
+	// keep, or 0 to continue.
+	std::function<bool(int)> completeHeader;
+	std::function<size_t(const std::string &)> completeBody;
+	const std::atomic<bool> *canceled = nullptr;
+};
+
+// ends of the phases of a transfer in usec from its start, 0 if unknown
+struct NicoLiveTiming {
+	long long nameLookupUsec = 0;
+	long long connectUsec = 0;
+	long long appConnectUsec = 0;
+	long long startTransferUsec = 0;
+	long long totalUsec = 0;
+};
+
+// The buffers are reused by the next request, so keep their capacity.
+struct NicoLiveResponse {
+	int code = 0;
+	// raw header lines
+	std::string header;
+	std::string body;
+	// NicoLiveApi::hashString of body
+	uint64_t bodyHash = 0;
+	bool hedgeWon = false;
+	NicoLiveTiming timing;
+	bool reused = false;
+	// why the transfer failed, for Result::FAILED
+	std::string error;
+};
+
+class NicoLiveTransport {
+public:
+	enum class Result {
+		OK,
+		INIT_ERROR,
+		FAILED,
+		CANCELED,
+		TIMEOUT,
+	};
+	virtual ~NicoLiveTransport() {}
+	virtual Result perform(const NicoLiveRequest &request,
+		NicoLiveResponse *response, NicoLiveMetrics *metrics) = 0;
+};
@@ -0,0 +1,105 @@
+#include <QtCore>
+#include "nico-live-virtual-clock.hpp"
+
+NicoLiveVirtualTimer::NicoLiveVirtualTimer(NicoLiveVirtualClock *clock,
+	QObject *parent) :
+	NicoLiveTimer(parent),
+	clock(clock)
+{
+	this->clock->timers.append(this);
+}
+
+NicoLiveVirtualTimer::~NicoLiveVirtualTimer()
+{
+	this->clock->timers.removeOne(this);
+}
+
+void NicoLiveVirtualTimer::start(int msec)
+{
+	this->active = true;
+	this->dueMsec = this->clock->elapsedMsec + qMax(msec, 0);
+	this->sequence = this->clock->nextSequence++;
+}
+
+void NicoLiveVirtualTimer::stop()
+{
+	this->active = false;
+}
+
+bool NicoLiveVirtualTimer::isActive() const
+{
+	return this->active;
+}
+
+int NicoLiveVirtualTimer::remainingTime() const
+{
+	if (!this->active) {
+		return -1;
+	}
+	return static_cast<int>(qMax(this->dueMsec - this->clock->elapsedMsec,
+		static_cast<qint64>(0)));
+}
+
+NicoLiveVirtualClock::NicoLiveVirtualClock(const QDateTime &epoch) :
+	epoch(epoch)
+{
+}
+
+QDateTime NicoLiveVirtualClock::now() const
+{
+	return this->epoch.addMSecs(this->elapsedMsec);
+}
+
+NicoLiveTimer *NicoLiveVirtualClock::createTimer(QObject *parent)
+{
+	return new NicoLiveVirtualTimer(this, parent);
+}
+
+qint64 NicoLiveVirtualClock::elapsed() const
+{
+	return this->elapsedMsec;
+}
+
+NicoLiveVirtualTimer *NicoLiveVirtualClock::nextTimer() const
+{
+	NicoLiveVirtualTimer *next = nullptr;
+	for (NicoLiveVirtualTimer *timer: this->timers) {
+		if (!timer->active) {
+			continue;
+		}
+		if (next == nullptr || timer->dueMsec < next->dueMsec ||
+				(timer->dueMsec == next->dueMsec &&
+				timer->sequence < next->sequence)) {
+			next = timer;
+		}
+	}
+	return next;
+}
+
+bool NicoLiveVirtualClock::advanceToNext()
+{
+	NicoLiveVirtualTimer *timer = this->nextTimer();
+	if (timer == nullptr) {
+		return false;
+	}
+	this->elapsedMsec = qMax(this->elapsedMsec, timer->dueMsec);
+	timer->active = false;
+	emit timer->timeout();
+	return true;
+}
+
+int NicoLiveVirtualClock::advance(qint64 msec)
+{
+	qint64 target = this->elapsedMsec + msec;
+	int fired = 0;
+	for (;;) {
+		NicoLiveVirtualTimer *timer = this->nextTimer();
+		if (timer == nullptr || timer->dueMsec > target) {
+			break;
+		}
+		this->advanceToNext();
+		fired++;
+	}
+	this->elapsedMsec = target;
+	return fired;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QtCore>
+#include "nico-live-clock.hpp"
+
+class NicoLiveVirtualClock;
+
+class NicoLiveVirtualTimer : public NicoLiveTimer {
+	Q_OBJECT
+	friend class NicoLiveVirtualClock;
+private:
+	NicoLiveVirtualClock *clock;
+	bool active = false;
+	qint64 dueMsec = 0;
+	// start order, to fire timers with the same due time in order
+	quint64 sequence = 0;
+public:
+	NicoLiveVirtualTimer(NicoLiveVirtualClock *clock,
+		QObject *parent = nullptr);
+	~NicoLiveVirtualTimer();
+	void start(int msec) override;
+	void stop() override;
+	bool isActive() const override;
+	int remainingTime() const override;
+};
+
+// Time which moves only by advance(). Timers due in the advanced span fire
+// in due order with now() set to their due time, so a week of watching
+// runs as fast as the watcher itself.
+class NicoLiveVirtualClock : public NicoLiveClock {
+	friend class NicoLiveVirtualTimer;
+private:
+	QDateTime epoch;
+	qint64 elapsedMsec = 0;
+	quint64 nextSequence = 0;
+	QList<NicoLiveVirtualTimer *> timers;
+public:
+	NicoLiveVirtualClock(const QDateTime &epoch =
+		QDateTime::currentDateTime());
+	QDateTime now() const override;
+	NicoLiveTimer *createTimer(QObject *parent) override;
+	qint64 elapsed() const;
+	// returns the number of fired timers
+	int advance(qint64 msec);
+	// advance to the next due timer and fire it, false if none is active
+	bool advanceToNext();
+private:
+	NicoLiveVirtualTimer *nextTimer() const;
+};
@@ -1,16 +1,18 @@
 #include <QtCore>
 #include "nicolive.h"
+#include "nicolive-trace.h"
 #include "nico-live.hpp"
 #include "nico-live-watcher.hpp"
 #include "nicolive-ui.h"
+#include "nico-live-api.hpp"
+#include "nico-live-clock.hpp"
 
 NicoLiveWatcher::NicoLiveWatcher(NicoLive *nicolive, int margin_sec) :
 	QObject(nicolive),
 	nicolive(nicolive),
 	marginTime(margin_sec * 1000)
 {
-	this->timer = new QTimer(this);
-	this->timer->setSingleShot(true);
+	this->timer = nicolive->clock->createTimer(this);
 	connect(timer, SIGNAL(timeout()), this, SLOT(watch()));
 }
 
@@ -41,6 +43,7 @@ void NicoLiveWatcher::start(long long sec)
 
 void NicoLiveWatcher::stop()
 {
+	nicolive->cancelAccess();
 	if (this->timer->isActive()) {
 		nicolive_log_debug("stop watch ");
 		this->timer->stop();
@@ -60,12 +63,16 @@ int NicoLiveWatcher::remainingTime()
 
 void NicoLiveWatcher::watch()
 {
+	nicolive_trace_scope("watch");
 	nicolive_log_debug("watching!");
 
 	int next_interval = this->interval;
 	int remaining_msec;
 
+	// login and pubstat at worst
+	nicolive->webApi->beginOperation(NicoLive::WATCH_BUDGET_MSEC, 2);
 	nicolive->sitePubStat();
+	nicolive->webApi->endOperation();
 	remaining_msec = nicolive->getRemainingLive() * 1000;
 	if (remaining_msec < 0)
 		remaining_msec = 0;
@@ -73,21 +80,27 @@ void NicoLiveWatcher::watch()
 	if (nicolive->getLiveId().isEmpty()) {
 		if (nicolive->isOnair()) {
 			nicolive_log_debug("stop streaming because live end");
-			nicolive_streaming_click();
+			nicolive_streaming_stop();
 			next_interval = this->marginTime;
 		}
 	} else {
 		if (nicolive->getLiveId() != nicolive->getOnairLiveId()) {
 			if (nicolive->isOnair()) {
 				nicolive_log_debug(
-					"stop streaming for restart");
-				nicolive_streaming_click();
-				QThread::sleep(1); // sleep 1 sec
+					"restart streaming for next live");
+				nicolive_streaming_restart();
+			} else {
+				nicolive_log_debug(
+					"start streaming for next live");
+				nicolive_streaming_start();
 			}
-			nicolive_log_debug("start streaming for next live");
-			nicolive_streaming_click();
 		} else if (remaining_msec + this->marginTime < next_interval) {
 			next_interval = remaining_msec + this->marginTime;
+			if (this->endingLiveId != nicolive->getLiveId()) {
+				this->endingLiveId = nicolive->getLiveId();
+				emit nicolive->liveEnding(this->endingLiveId,
+					remaining_msec / 1000);
+			}
 		}
 	}
 	this->timer->start(next_interval);
@@ -3,6 +3,7 @@
 #include <QtCore>
 
 class NicoLive;
+class NicoLiveTimer;
 
 class NicoLiveWatcher : public QObject {
 	Q_OBJECT
@@ -14,7 +15,8 @@ private:
 	int marginTime;
 	int interval = 60 * 1000;
 	bool active = false;
-	QTimer *timer;
+	QString endingLiveId;
+	NicoLiveTimer *timer;
 public:
 	NicoLiveWatcher(NicoLive *nicolive, int margin_sec = 10);
 	~NicoLiveWatcher();
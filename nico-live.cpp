@@ -4,24 +4,48 @@
 #include <QtCore>
 #include <curl/curl.h>
 #include "nicolive.h"
+#include "nicolive-trace.h"
 #include "nico-live.hpp"
 #include "nico-live-watcher.hpp"
 #include "nico-live-api.hpp"
+#include "nico-live-clock.hpp"
+#include "nico-live-metrics-server.hpp"
+#include "nico-live-output-sampler.hpp"
+#include "nico-live-auto-tune.hpp"
+#include "nico-live-bandwidth-probe.hpp"
 
-NicoLive::NicoLive(QObject *parent)
+NicoLive::NicoLive(QObject *parent, NicoLiveClock *clock)
 {
 	(void)parent;
+	this->clock = clock != nullptr ? clock : NicoLiveClock::system();
 	watcher = new NicoLiveWatcher(this);
 	webApi = new NicoLiveApi();
+	metricsServer = NicoLiveMetricsServer::shared();
+	outputSampler = new NicoLiveOutputSampler();
+	autoTune = new NicoLiveAutoTune();
+	bandwidthProbe = new NicoLiveBandwidthProbe();
+	outputSampler->setAdjustedCallback([this]() {
+		emit bitrateAdjusted();
+	});
+	connect(this, &NicoLive::bitrateAdjusted, this, [this]() {
+		this->updateMetrics();
+	}, Qt::QueuedConnection);
 }
 
 NicoLive::~NicoLive()
 {
+	this->webApi->cancel();
+	this->webApi->logTimings();
+	delete outputSampler;
+	delete autoTune;
+	delete bandwidthProbe;
+	metricsServer->removeSource(this);
 	delete webApi;
 }
 
 void NicoLive::setSession(const QString &session)
 {
+	this->webApi->resetPublishStatusHash();
 	this->session = session;
 	this->flags.session_valid = false;
 	this->flags.load_viqo = false;
@@ -35,6 +59,7 @@ void NicoLive::setSession(const char *session)
 
 void NicoLive::setAccount(const QString &mail, const QString &password)
 {
+	this->webApi->resetPublishStatusHash();
 	this->mail = mail;
 	this->password = password;
 	this->flags.session_valid = false;
@@ -43,6 +68,7 @@ void NicoLive::setAccount(const QString &mail, const QString &password)
 
 void NicoLive::setAccount(const char *mail, const char *password)
 {
+	this->webApi->resetPublishStatusHash();
 	this->mail = mail;
 	this->password = password;
 	this->flags.session_valid = false;
@@ -54,6 +80,80 @@ void NicoLive::setEnabledAdjustBitrate(bool enabled)
 	this->flags.adjust_bitrate = enabled;
 }
 
+void NicoLive::setEnabledHedgeRequest(bool enabled)
+{
+	this->webApi->setEnabledHedge(enabled);
+}
+
+void NicoLive::setEnabledLowerAudio(bool enabled)
+{
+	this->flags.lower_audio = enabled;
+}
+
+void NicoLive::setEnabledAdaptiveBitrate(bool enabled)
+{
+	this->outputSampler->setEnabledAdaptiveBitrate(enabled);
+}
+
+void NicoLive::setEnabledAutoTune(bool enabled)
+{
+	this->flags.auto_tune = enabled;
+}
+
+void NicoLive::setEnabledBandwidthProbe(bool enabled)
+{
+	this->flags.bandwidth_probe = enabled;
+	if (!enabled)
+		this->bandwidthProbe->cancel();
+}
+
+void NicoLive::setTransport(NicoLiveTransport *transport)
+{
+	this->webApi->setTransport(transport);
+}
+
+bool NicoLive::setMetricsPort(int port)
+{
+	bool result = this->metricsServer->setPort(this, port);
+	this->updateMetrics();
+	return result;
+}
+
+NicoLiveOutputSampler *NicoLive::getOutputSampler()
+{
+	return this->outputSampler;
+}
+
+const NicoLiveAutoTune *NicoLive::getAutoTune() const
+{
+	return this->autoTune;
+}
+
+void NicoLive::setApiBaseUrl(const char *baseUrl)
+{
+	this->webApi->setBaseUrl(baseUrl);
+}
+
+void NicoLive::setTraffic(int mode, const char *path)
+{
+	switch (mode) {
+	case NICOLIVE_TRAFFIC_RECORD:
+		this->webApi->setTraffic(NicoLiveApi::TrafficMode::RECORD,
+			path);
+		break;
+	case NICOLIVE_TRAFFIC_REPLAY:
+		this->webApi->setTraffic(NicoLiveApi::TrafficMode::REPLAY,
+			path);
+		break;
+	case NICOLIVE_TRAFFIC_REPLAY_TIMED:
+		this->webApi->setTraffic(
+			NicoLiveApi::TrafficMode::REPLAY_TIMED, path);
+		break;
+	default:
+		this->webApi->setTraffic(NicoLiveApi::TrafficMode::OFF, path);
+	}
+}
+
 const QString &NicoLive::getMail() const
 {
 	return this->mail;
@@ -89,6 +189,44 @@ long long NicoLive::getLiveBitrate() const
 	return this->live_info.bitrate;
 }
 
+long long NicoLive::getSafeBitrate()
+{
+	long long bitrate = this->live_info.bitrate;
+	if (!this->flags.bandwidth_probe)
+		return bitrate;
+
+	std::string host;
+	int port;
+	if (!NicoLiveBandwidthProbe::parseRtmpUrl(
+			this->live_info.url.toStdString(), &host, &port)) {
+		nicolive_log_warn("cannot probe: unknown rtmp url");
+		return bitrate;
+	}
+	NicoLiveBandwidthProbe::Result result;
+	if (!this->bandwidthProbe->getFreshResult(host, port, &result)) {
+		// not to delay the stream, the probe ahead of the live may
+		// still be running and is for the next start
+		nicolive_log_info("no fresh probe, use bitrate %lld kbps",
+			bitrate);
+		return bitrate;
+	}
+	if (!result.ok)
+		return bitrate;
+
+	long long safe = result.kbps * NicoLive::PROBE_SAFETY_PERCENT / 100;
+	if (bitrate <= 0) {
+		// no cap to clamp, the probe is all there is
+		nicolive_log_info("bitrate %lld kbps by probe", safe);
+		return safe;
+	}
+	if (safe < bitrate) {
+		nicolive_log_info("clamp bitrate %lld to %lld kbps by probe",
+			bitrate, safe);
+		return safe;
+	}
+	return bitrate;
+}
+
 const QString &NicoLive::getOnairLiveId() const
 {
 	return this->onair_live_id;
@@ -97,7 +235,7 @@ const QString &NicoLive::getOnairLiveId() const
 int NicoLive::getRemainingLive() const
 {
 	if (isOnair())
-		return QDateTime::currentDateTime().secsTo(
+		return this->clock->now().secsTo(
 			this->live_info.end_time);
 	else
 		return 0;
@@ -108,6 +246,31 @@ bool NicoLive::enabledAdjustBitrate() const
 	return this->flags.adjust_bitrate;
 }
 
+bool NicoLive::enabledHedgeRequest() const
+{
+	return this->webApi->enabledHedge();
+}
+
+bool NicoLive::enabledLowerAudio() const
+{
+	return this->flags.lower_audio;
+}
+
+bool NicoLive::enabledAdaptiveBitrate() const
+{
+	return this->outputSampler->enabledAdaptiveBitrate();
+}
+
+bool NicoLive::enabledAutoTune() const
+{
+	return this->flags.auto_tune;
+}
+
+bool NicoLive::enabledBandwidthProbe() const
+{
+	return this->flags.bandwidth_probe;
+}
+
 bool NicoLive::enabledSession() const
 {
 	return this->flags.session_valid;
@@ -120,14 +283,40 @@ bool NicoLive::isOnair() const
 
 void NicoLive::startStreaming()
 {
+	this->webApi->resetPublishStatusHash();
 	this->onair_live_id = getLiveId();
 	this->flags.onair = true;
+
+	if (this->stats.stop_time.isValid()) {
+		qint64 gap = this->stats.stop_time.msecsTo(
+			this->clock->now());
+		this->stats.offair_gap_count++;
+		this->stats.offair_gap_msec_sum += gap;
+		this->stats.offair_gap_msec_last = gap;
+		if (!this->stats.stop_live_id.isEmpty() &&
+				this->stats.stop_live_id != this->onair_live_id)
+			this->stats.transitions++;
+		this->stats.stop_time = QDateTime();
+	}
+	this->outputSampler->start(this->onair_live_id.toStdString());
+	this->updateMetrics();
 }
 
 void NicoLive::stopStreaming()
 {
+	this->outputSampler->stop();
+	if (this->flags.auto_tune) {
+		NicoLiveOutputSampler::Summary summary =
+			this->outputSampler->getSummary();
+		this->autoTune->reportBroadcast(summary.videoFrames,
+			summary.skippedFrames);
+	}
+	this->webApi->resetPublishStatusHash();
+	this->stats.stop_time = this->clock->now();
+	this->stats.stop_live_id = this->onair_live_id;
 	this->onair_live_id = QString();
 	this->flags.onair = false;
+	this->updateMetrics();
 }
 
 void NicoLive::startWatching(long long sec)
@@ -151,9 +340,81 @@ bool NicoLive::silentOnce()
 	return once;
 }
 
+long long NicoLive::getPubStatChangedCount() const
+{
+	return this->stats.pubstat_changed;
+}
+
+long long NicoLive::getPubStatUnchangedCount() const
+{
+	return this->stats.pubstat_unchanged;
+}
+
+long long NicoLive::getPubStatFailedCount() const
+{
+	return this->stats.pubstat_failed;
+}
+
+long long NicoLive::getLoginAttemptCount() const
+{
+	return this->stats.login_attempts;
+}
+
+long long NicoLive::getLoginFailureCount() const
+{
+	return this->stats.login_failures;
+}
+
+long long NicoLive::getTransitionCount() const
+{
+	return this->stats.transitions;
+}
+
+long long NicoLive::getOffairGapCount() const
+{
+	return this->stats.offair_gap_count;
+}
+
+long long NicoLive::getOffairGapMsecSum() const
+{
+	return this->stats.offair_gap_msec_sum;
+}
+
+long long NicoLive::getOffairGapMsecLast() const
+{
+	return this->stats.offair_gap_msec_last;
+}
+
+const QString &NicoLive::getLiveRtmpUrl() const
+{
+	return this->live_info.url;
+}
+
+const QDateTime &NicoLive::getLiveStartTime() const
+{
+	return this->live_info.start_time;
+}
+
+const QDateTime &NicoLive::getLiveEndTime() const
+{
+	return this->live_info.end_time;
+}
+
+bool NicoLive::isLiveExcluded() const
+{
+	return this->live_info.exclude;
+}
+
 bool NicoLive::checkSession()
 {
-	return (sitePubStat() || (siteLoginNLE() && sitePubStat()));
+	nicolive_trace_scope("checkSession");
+	// a check is asked for by the user, so a former cancel is over
+	this->resumeAccess();
+	// pubstat, login and pubstat again at worst
+	this->webApi->beginOperation(NicoLive::CHECK_SESSION_BUDGET_MSEC, 3);
+	bool result = (sitePubStat() || (siteLoginNLE() && sitePubStat()));
+	this->webApi->endOperation();
+	return result;
 }
 
 bool NicoLive::checkLive()
@@ -161,6 +422,16 @@ bool NicoLive::checkLive()
 	return siteLiveProf();
 }
 
+void NicoLive::cancelAccess()
+{
+	this->webApi->cancel();
+}
+
+void NicoLive::resumeAccess()
+{
+	this->webApi->clearCancel();
+}
+
 bool NicoLive::siteLogin()
 {
 	if (this->mail.isEmpty() || this->password.isEmpty()) {
@@ -168,35 +439,45 @@ bool NicoLive::siteLogin()
 		return false;
 	}
 
+	this->stats.login_attempts++;
 	bool result = this->webApi->loginSiteNicolive(this->mail.toStdString(),
 		this->password.toStdString());
 	if (result) {
 		this->session = this->webApi->getCookie("user_session").c_str();
+	} else {
+		this->stats.login_failures++;
 	}
+	this->updateMetrics();
 	return result;
 }
 
 bool NicoLive::siteLoginNLE()
 {
+	nicolive_trace_scope("siteLoginNLE");
 	if (this->mail.isEmpty() || this->password.isEmpty()) {
 		nicolive_log_warn("no mail or password");
 		return false;
 	}
 
+	this->stats.login_attempts++;
 	std::string result = this->webApi->loginNicoliveEncoder(
 		this->mail.toStdString(),
 		this->password.toStdString());
 	nicolive_log_debug("ticket: %s", result.c_str());
 	if (!result.empty()) {
 		this->ticket = result.c_str();
+		this->updateMetrics();
 		return true;
 	} else {
+		this->stats.login_failures++;
+		this->updateMetrics();
 		return false;
 	}
 }
 
 bool NicoLive::sitePubStat()
 {
+	nicolive_trace_scope("sitePubStat");
 	nicolive_log_debug("session: %s",
 			this->session.toStdString().c_str());
 	nicolive_log_debug("ticket: %s",
@@ -215,43 +496,176 @@ bool NicoLive::sitePubStat()
 		}
 	}
 
-	const std::string statusXpath = "/getpublishstatus/@status";
-	const std::string errorCodeXpath =
+	static const std::string statusXpath = "/getpublishstatus/@status";
+	static const std::string errorCodeXpath =
 		"/getpublishstatus/error/code/text()";
-	const std::unordered_map<std::string, std::string> xpathMap = {
-		{"id", "/getpublishstatus//stream/id/text()"},
-		{"exclude", "/getpublishstatus//stream/exclude/text()"},
-		{"base_time", "/getpublishstatus//stream/base_time/text()"},
-		{"open_time", "/getpublishstatus//stream/open_time/text()"},
-		{"start_time", "/getpublishstatus//stream/start_time/text()"},
-		{"end_time", "/getpublishstatus//stream/end_time/text()"},
-		{"url", "/getpublishstatus//rtmp/url/text()"},
-		{"stream", "/getpublishstatus//rtmp/stream/text()"},
-		{"ticket", "/getpublishstatus//rtmp/ticket/text()"},
-		{"bitrate", "/getpublishstatus//rtmp/bitrate/text()"},
-	};
-
-	std::unordered_map<std::string, std::vector<std::string>> data;
-	data[statusXpath] = std::vector<std::string>();
-	data[errorCodeXpath] = std::vector<std::string>();
-	for (auto &xpathPair: xpathMap) {
-		data[xpathPair.second] = std::vector<std::string>();
+	const std::unordered_map<std::string, std::string> &xpathMap =
+		NicoLive::pubStatXpathMap();
+
+	// emptied keeping the capacities, parsed into only when changed
+	std::unordered_map<std::string, std::vector<std::string>> &data =
+		this->pubStatData;
+	if (data.empty()) {
+		data[statusXpath] = std::vector<std::string>();
+		data[errorCodeXpath] = std::vector<std::string>();
+		for (auto &xpathPair: xpathMap) {
+			data[xpathPair.second] = std::vector<std::string>();
+		}
+	} else {
+		for (auto &entry: data) {
+			entry.second.clear();
+		}
 	}
 
 	bool result = false;
+	bool changed = true;
 	if (useTicket) {
 		result = this->webApi->getPublishStatusTicket(
 			this->ticket.toStdString(),
-			&data);
+			&data, &changed);
 	} else {
-		result = this->webApi->getPublishStatus(&data);
+		result = this->webApi->getPublishStatus(&data, &changed);
 	}
 
 	if (!result) {
 		nicolive_log_error("failed get publish status web page");
+		this->stats.pubstat_failed++;
+		this->updateMetrics();
 		return false;
 	}
 
+	if (!changed) {
+		this->stats.pubstat_unchanged++;
+		this->updateMetrics();
+		return this->flags.session_valid;
+	}
+	this->stats.pubstat_changed++;
+
+	auto previous = this->live_info;
+	bool success = updatePubStat(data);
+	if (!success) {
+		// always retry a failed status
+		this->webApi->resetPublishStatusHash();
+	}
+	if (previous.id != this->live_info.id ||
+			previous.url != this->live_info.url ||
+			previous.stream != this->live_info.stream ||
+			previous.ticket != this->live_info.ticket ||
+			previous.base_time != this->live_info.base_time ||
+			previous.open_time != this->live_info.open_time ||
+			previous.start_time != this->live_info.start_time ||
+			previous.end_time != this->live_info.end_time ||
+			previous.bitrate != this->live_info.bitrate ||
+			previous.exclude != this->live_info.exclude) {
+		emit liveInfoChanged();
+	}
+	if (previous.id != this->live_info.id)
+		emit liveChanged(this->live_info.id, previous.id);
+	if (this->flags.bandwidth_probe && !this->isOnair() &&
+			previous.url != this->live_info.url) {
+		// probe ahead of the open time, not to compete with a stream
+		std::string host;
+		int port;
+		if (NicoLiveBandwidthProbe::parseRtmpUrl(
+				this->live_info.url.toStdString(), &host, &port))
+			this->bandwidthProbe->measureAsync(host, port);
+	}
+	this->updateMetrics();
+	return success;
+}
+
+static void appendMetric(std::string *text, const char *name,
+	const char *type, const char *help, long long value)
+{
+	*text += "# HELP ";
+	*text += name;
+	*text += " ";
+	*text += help;
+	*text += "\n# TYPE ";
+	*text += name;
+	*text += " ";
+	*text += type;
+	*text += "\n";
+	*text += name;
+	*text += " ";
+	*text += std::to_string(value);
+	*text += "\n";
+}
+
+void NicoLive::updateMetrics()
+{
+	emit statsChanged();
+	if (this->metricsServer->getPort() == 0)
+		return;
+
+	std::string text;
+	text += "# HELP nicolive_request_duration_seconds "
+		"Duration of web accesses.\n"
+		"# TYPE nicolive_request_duration_seconds histogram\n";
+	for (int i = 0; i < static_cast<int>(NicoLiveApi::Endpoint::COUNT);
+			i++) {
+		NicoLiveApi::Endpoint endpoint =
+			static_cast<NicoLiveApi::Endpoint>(i);
+		NicoLiveMetricsServer::appendHistogram(&text,
+			"nicolive_request_duration_seconds",
+			std::string("endpoint=\"") +
+				NicoLiveApi::endpointName(endpoint) + "\"",
+			this->webApi->getTimings(endpoint).total);
+	}
+	text += "# HELP nicolive_polls_total Publish status polls.\n"
+		"# TYPE nicolive_polls_total counter\n";
+	text += "nicolive_polls_total{result=\"changed\"} " +
+		std::to_string(this->stats.pubstat_changed) + "\n";
+	text += "nicolive_polls_total{result=\"unchanged\"} " +
+		std::to_string(this->stats.pubstat_unchanged) + "\n";
+	text += "nicolive_polls_total{result=\"failed\"} " +
+		std::to_string(this->stats.pubstat_failed) + "\n";
+	appendMetric(&text, "nicolive_login_attempts_total", "counter",
+		"Login attempts.", this->stats.login_attempts);
+	appendMetric(&text, "nicolive_login_failures_total", "counter",
+		"Failed logins.", this->stats.login_failures);
+	appendMetric(&text, "nicolive_transitions_total", "counter",
+		"Streams restarted for the next live.",
+		this->stats.transitions);
+	appendMetric(&text, "nicolive_offair_gaps_total", "counter",
+		"Off-air gaps between stop and start of streaming.",
+		this->stats.offair_gap_count);
+	appendMetric(&text, "nicolive_offair_gap_milliseconds_total",
+		"counter", "Sum of off-air gaps.",
+		this->stats.offair_gap_msec_sum);
+	appendMetric(&text, "nicolive_last_offair_gap_milliseconds", "gauge",
+		"Last off-air gap.", this->stats.offair_gap_msec_last);
+	appendMetric(&text, "nicolive_onair", "gauge",
+		"1 while streaming.", this->isOnair() ? 1 : 0);
+	appendMetric(&text, "nicolive_session_valid", "gauge",
+		"1 while the login session is valid.",
+		this->flags.session_valid ? 1 : 0);
+	NicoLiveBitrateController::Stats bitrate =
+		this->outputSampler->getBitrateStats();
+	appendMetric(&text, "nicolive_video_bitrate_kbps", "gauge",
+		"Video bitrate set by the adaptive bitrate.", bitrate.kbps);
+	appendMetric(&text, "nicolive_video_bitrate_cap_kbps", "gauge",
+		"Video bitrate cap of the live.", bitrate.capKbps);
+	appendMetric(&text, "nicolive_bitrate_decreases_total", "counter",
+		"Bitrate decreases on congestion or dropped frames.",
+		bitrate.decreases);
+	appendMetric(&text, "nicolive_bitrate_increases_total", "counter",
+		"Bitrate increases toward the cap.", bitrate.increases);
+
+	this->metricsServer->setSnapshot(this, text, this->isOnair() &&
+		this->live_info.end_time.isValid() ?
+		this->live_info.end_time.toMSecsSinceEpoch() / 1000 : 0);
+}
+
+bool NicoLive::updatePubStat(
+	std::unordered_map<std::string, std::vector<std::string>> &data)
+{
+	const std::string statusXpath = "/getpublishstatus/@status";
+	const std::string errorCodeXpath =
+		"/getpublishstatus/error/code/text()";
+	const std::unordered_map<std::string, std::string> &xpathMap =
+		NicoLive::pubStatXpathMap();
+
 	if (data[statusXpath].empty()) {
 		nicolive_log_error("faield get publish status");
 		return false;
@@ -315,13 +729,34 @@ bool NicoLive::sitePubStat()
 	if (success) {
 		this->flags.session_valid = true;
 	} else {
+		if (this->flags.session_valid)
+			emit sessionInvalid();
 		this->flags.session_valid = false;
 	}
 
 	return success;
 }
 
+const std::unordered_map<std::string, std::string> &
+NicoLive::pubStatXpathMap()
+{
+	static const std::unordered_map<std::string, std::string> xpathMap = {
+		{"id", "/getpublishstatus//stream/id/text()"},
+		{"exclude", "/getpublishstatus//stream/exclude/text()"},
+		{"base_time", "/getpublishstatus//stream/base_time/text()"},
+		{"open_time", "/getpublishstatus//stream/open_time/text()"},
+		{"start_time", "/getpublishstatus//stream/start_time/text()"},
+		{"end_time", "/getpublishstatus//stream/end_time/text()"},
+		{"url", "/getpublishstatus//rtmp/url/text()"},
+		{"stream", "/getpublishstatus//rtmp/stream/text()"},
+		{"ticket", "/getpublishstatus//rtmp/ticket/text()"},
+		{"bitrate", "/getpublishstatus//rtmp/bitrate/text()"},
+	};
+	return xpathMap;
+}
+
 bool NicoLive::siteLiveProf() {
+	nicolive_trace_scope("siteLiveProf");
 
 	if (this->live_info.id.isEmpty()) {
 		nicolive_log_debug("this->live_info.id is empty.");
@@ -1,16 +1,32 @@
 #pragma once
 
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include <QtCore>
 // #include <QtNetwork>
 
 class NicoLiveWatcher;
 class NicoLiveCmdServer;
 class NicoLiveApi;
+class NicoLiveClock;
+class NicoLiveTransport;
+class NicoLiveMetricsServer;
+class NicoLiveOutputSampler;
+class NicoLiveAutoTune;
+class NicoLiveBandwidthProbe;
 
 class NicoLive : public QObject {
 	Q_OBJECT
 	friend class NicoLiveWatcher;
 public:
+	// Time budget of all web accesses in one operation. The watcher and
+	// checkSession access on the GUI thread and block it until done, so
+	// these bound how long OBS may stop responding.
+	static const long long CHECK_SESSION_BUDGET_MSEC = 8 * 1000; // 8s
+	static const long long WATCH_BUDGET_MSEC = 5 * 1000; // 5s
+	// share of the probed upload throughput used for the stream
+	static const int PROBE_SAFETY_PERCENT = 80;
 private:
 	QString mail;
 	QString password;
@@ -36,18 +52,58 @@ private:
 		bool onair = false;
 		bool load_viqo = false;
 		bool adjust_bitrate = false;
+		bool lower_audio = false;
+		bool auto_tune = false;
+		bool bandwidth_probe = false;
 		bool silent_once = false;
 	} flags;
+	struct {
+		long long pubstat_changed = 0;
+		long long pubstat_unchanged = 0;
+		long long pubstat_failed = 0;
+		long long login_attempts = 0;
+		long long login_failures = 0;
+		long long transitions = 0;
+		long long offair_gap_count = 0;
+		long long offair_gap_msec_sum = 0;
+		long long offair_gap_msec_last = 0;
+		QDateTime stop_time;
+		QString stop_live_id;
+	} stats;
+	NicoLiveMetricsServer *metricsServer; // shared by the process
+	NicoLiveOutputSampler *outputSampler;
+	NicoLiveAutoTune *autoTune;
+	NicoLiveBandwidthProbe *bandwidthProbe;
+	NicoLiveClock *clock;
 	NicoLiveWatcher *watcher;
 	NicoLiveApi *webApi;
+	// kept between polls, so that an unchanged status does not allocate
+	std::unordered_map<std::string, std::vector<std::string>> pubStatData;
 public:
-	NicoLive(QObject *parent = 0);
+	// clock is not owned, the system clock by default
+	NicoLive(QObject *parent = 0, NicoLiveClock *clock = nullptr);
 	~NicoLive();
 	void setSession(const char *session);
 	void setSession(const QString &session);
 	void setAccount(const char *mail, const char *password);
 	void setAccount(const QString &mail, const QString &password);
 	void setEnabledAdjustBitrate(bool enabled);
+	void setEnabledHedgeRequest(bool enabled);
+	void setEnabledLowerAudio(bool enabled);
+	void setEnabledAdaptiveBitrate(bool enabled);
+	void setEnabledAutoTune(bool enabled);
+	void setEnabledBandwidthProbe(bool enabled);
+	// mode is enum nicolive_traffic_mode
+	void setTraffic(int mode, const char *path);
+	void setApiBaseUrl(const char *baseUrl);
+	// takes ownership of transport
+	void setTransport(NicoLiveTransport *transport);
+	// loopback port of the Prometheus metrics, 0 to disable
+	bool setMetricsPort(int port);
+	// samples the output between startStreaming and stopStreaming
+	NicoLiveOutputSampler *getOutputSampler();
+	// learns from the frames skipped in each broadcast
+	const NicoLiveAutoTune *getAutoTune() const;
 
 	const QString &getMail() const;
 	const QString &getPassword() const;
@@ -56,10 +112,19 @@ public:
 	const QString &getLiveUrl() const;
 	const QString &getLiveKey() const;
 	long long getLiveBitrate() const;
+	// the live bitrate clamped to a fresh probe of the upload throughput,
+	// the probe alone if the live has no bitrate; does not block, without
+	// a fresh probe it is the live bitrate
+	long long getSafeBitrate();
 	const QString &getOnairLiveId() const;
 	int getRemainingLive() const;
 
 	bool enabledAdjustBitrate() const;
+	bool enabledHedgeRequest() const;
+	bool enabledLowerAudio() const;
+	bool enabledAdaptiveBitrate() const;
+	bool enabledAutoTune() const;
+	bool enabledBandwidthProbe() const;
 	bool enabledSession() const;
 	bool isOnair() const;
 
@@ -70,10 +135,42 @@ public:
 
 	bool checkSession();
 	bool checkLive();
+	// Cancel web accesses until resumeAccess(). A transfer in flight is
+	// interrupted only when called from another thread than the one
+	// accessing; on the GUI thread it stops the accesses after the
+	// current one.
+	void cancelAccess();
+	void resumeAccess();
 	bool loadViqoSettings();
 
 	void nextSilentOnce();
 	bool silentOnce();
+
+	long long getPubStatChangedCount() const;
+	long long getPubStatUnchangedCount() const;
+	long long getPubStatFailedCount() const;
+	long long getLoginAttemptCount() const;
+	long long getLoginFailureCount() const;
+	long long getTransitionCount() const;
+	long long getOffairGapCount() const;
+	long long getOffairGapMsecSum() const;
+	long long getOffairGapMsecLast() const;
+	// the RTMP url without the ticket of getLiveUrl
+	const QString &getLiveRtmpUrl() const;
+	const QDateTime &getLiveStartTime() const;
+	const QDateTime &getLiveEndTime() const;
+	bool isLiveExcluded() const;
+signals:
+	void liveInfoChanged();
+	// the live id changed, previousLiveId or liveId may be empty
+	void liveChanged(const QString &liveId, const QString &previousLiveId);
+	// emitted once per live when the watcher schedules past its end
+	void liveEnding(const QString &liveId, int remainingSec);
+	// the session became invalid after it was valid
+	void sessionInvalid();
+	void statsChanged();
+	// emitted on the sampler thread
+	void bitrateAdjusted();
 private:
 	// Access Niconico Site
 	bool siteLogin();
@@ -82,4 +179,9 @@ private:
 	bool siteLiveProf();
 
 	void clearLiveInfo();
+	void updateMetrics();
+	static const std::unordered_map<std::string, std::string> &
+		pubStatXpathMap();
+	bool updatePubStat(
+		std::unordered_map<std::string, std::vector<std::string>> &data);
 };
@@ -0,0 +1,398 @@
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <util/base.h>
+#include "nicolive-log.h"
+
+namespace {
+	const size_t RING_SIZE = 1024; // power of 2
+	const size_t TEXT_SIZE = 480;
+	const size_t SITE_SIZE = 512; // power of 2
+	const unsigned RATE_PER_SEC = 20;
+
+	struct Slot {
+		std::atomic<size_t> sequence;
+		int level;
+		const char *site;
+		unsigned suppressed;
+		char text[TEXT_SIZE];
+	};
+
+	struct Site {
+		std::atomic<const char *> key;
+		std::atomic<long long> window;
+		std::atomic<unsigned> count;
+		std::atomic<unsigned> suppressed;
+	};
+
+	// bounded MPSC queue, see Dmitry Vyukov's bounded MPMC queue
+	struct Logger {
+		Slot slots[RING_SIZE];
+		Site sites[SITE_SIZE];
+		std::atomic<size_t> head;
+		std::atomic<size_t> tail;
+		std::atomic<unsigned> dropped;
+		std::atomic<bool> running;
+		std::atomic<bool> stopped;
+		// writers between the check of running and the queued message
+		std::atomic<int> writers;
+		// the thread waits on wake while sleeping and the queue is empty
+		std::atomic<bool> sleeping;
+		std::mutex wakeMutex;
+		std::condition_variable wake;
+		std::once_flag started;
+		std::mutex threadMutex;
+		std::thread thread;
+		std::chrono::steady_clock::time_point epoch;
+	};
+
+	Logger *logger()
+	{
+		static Logger *instance = []() {
+			Logger *created = new Logger();
+			for (size_t i = 0; i < RING_SIZE; i++) {
+				created->slots[i].sequence = i;
+			}
+			for (size_t i = 0; i < SITE_SIZE; i++) {
+				created->sites[i].key = nullptr;
+				created->sites[i].window = 0;
+				created->sites[i].count = 0;
+				created->sites[i].suppressed = 0;
+			}
+			created->head = 0;
+			created->tail = 0;
+			created->dropped = 0;
+			created->running = false;
+			created->stopped = false;
+			created->writers = 0;
+			created->sleeping = false;
+			created->epoch = std::chrono::steady_clock::now();
+			return created;
+		}();
+		return instance;
+	}
+}
+
+static Site *findSite(Logger *log, const char *site)
+{
+	size_t hash = reinterpret_cast<size_t>(site) >> 3;
+	for (size_t i = 0; i < SITE_SIZE; i++) {
+		Site *entry = &log->sites[(hash + i) & (SITE_SIZE - 1)];
+		const char *key = entry->key.load(std::memory_order_acquire);
+		if (key == site) {
+			return entry;
+		}
+		if (key == nullptr) {
+			const char *expected = nullptr;
+			if (entry->key.compare_exchange_strong(expected, site) ||
+					expected == site) {
+				return entry;
+			}
+		}
+	}
+	// table full, no rate limit
+	return nullptr;
+}
+
+// true if the site may log now, *suppressed is the count to report
+static bool allowSite(Logger *log, const char *site, unsigned *suppressed)
+{
+	*suppressed = 0;
+	Site *entry = findSite(log, site);
+	if (entry == nullptr) {
+		return true;
+	}
+	long long window = std::chrono::duration_cast<std::chrono::seconds>(
+		std::chrono::steady_clock::now() - log->epoch).count();
+	long long current = entry->window.load(std::memory_order_relaxed);
+	if (current != window && entry->window.compare_exchange_strong(
+			current, window)) {
+		entry->count = 0;
+	}
+	if (entry->count.fetch_add(1, std::memory_order_relaxed) >=
+			RATE_PER_SEC) {
+		entry->suppressed.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	*suppressed = entry->suppressed.exchange(0, std::memory_order_relaxed);
+	return true;
+}
+
+static void replaceValue(std::string *text, const char *marker,
+	const char *terminators)
+{
+	size_t markerLength = std::strlen(marker);
+	size_t begin = 0;
+	while ((begin = text->find(marker, begin)) != std::string::npos) {
+		begin += markerLength;
+		size_t end = text->find_first_of(terminators, begin);
+		if (end == std::string::npos) {
+			end = text->size();
+		}
+		text->replace(begin, end - begin, "***");
+		begin += 3;
+	}
+}
+
+static std::string redact(const char *text)
+{
+	std::string redacted(text);
+	// a space ends the value of a field too
+	replaceValue(&redacted, "user_session=", "; &\r\n");
+	replaceValue(&redacted, "ticket=", "; & \r\n");
+	replaceValue(&redacted, "<ticket>", "<");
+	replaceValue(&redacted, "password: ", " \r\n");
+	replaceValue(&redacted, "session: ", " \r\n");
+	replaceValue(&redacted, "ticket: ", " \r\n");
+	return redacted;
+}
+
+static const char *siteName(const char *site)
+{
+	const char *slash = std::strrchr(site, '/');
+	const char *backslash = std::strrchr(site, '\\');
+	if (backslash != nullptr && (slash == nullptr || backslash > slash)) {
+		slash = backslash;
+	}
+	return slash != nullptr ? slash + 1 : site;
+}
+
+static void writeMessage(int level, const char *site, unsigned suppressed,
+	const char *text)
+{
+	std::string redacted = redact(text);
+	if (suppressed > 0) {
+		blog(level, "[nicolive] %s (%u similar messages suppressed at %s)",
+			redacted.c_str(), suppressed, siteName(site));
+	} else {
+		blog(level, "[nicolive] %s", redacted.c_str());
+	}
+}
+
+static bool drain(Logger *log)
+{
+	bool drained = false;
+	for (;;) {
+		size_t position = log->tail.load(std::memory_order_relaxed);
+		Slot *slot = &log->slots[position & (RING_SIZE - 1)];
+		if (slot->sequence.load(std::memory_order_acquire) !=
+				position + 1) {
+			break;
+		}
+		writeMessage(slot->level, slot->site, slot->suppressed,
+			slot->text);
+		slot->sequence.store(position + RING_SIZE,
+			std::memory_order_release);
+		log->tail.store(position + 1, std::memory_order_relaxed);
+		drained = true;
+	}
+	unsigned dropped = log->dropped.exchange(0);
+	if (dropped > 0) {
+		blog(LOG_WARNING, "[nicolive] log buffer full, %u messages "
+			"dropped", dropped);
+	}
+	return drained;
+}
+
+static bool pending(Logger *log)
+{
+	size_t position = log->tail.load(std::memory_order_relaxed);
+	return log->slots[position & (RING_SIZE - 1)].sequence.load(
+		std::memory_order_acquire) == position + 1;
+}
+
+static void run(Logger *log)
+{
+	while (log->running) {
+		if (drain(log)) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(log->wakeMutex);
+		log->sleeping = true;
+		// pairs with the fence of writeWith, either sees the other
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		log->wake.wait(lock, [log]() {
+			return pending(log) || !log->running;
+		});
+		log->sleeping = false;
+	}
+	drain(log);
+}
+
+static void wakeUp(Logger *log)
+{
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (log->sleeping) {
+		std::lock_guard<std::mutex> lock(log->wakeMutex);
+		log->wake.notify_one();
+	}
+}
+
+static void start(Logger *log)
+{
+	std::call_once(log->started, [log]() {
+		std::lock_guard<std::mutex> lock(log->threadMutex);
+		if (log->stopped) {
+			return;
+		}
+		log->running = true;
+		log->thread = std::thread(run, log);
+	});
+}
+
+// format(text, size) writes the message into text, once and only if the
+// site may log now
+template <typename Format>
+static void writeWith(int level, const char *site, Format format)
+{
+	Logger *log = logger();
+	unsigned suppressed;
+	if (!allowSite(log, site, &suppressed)) {
+		return;
+	}
+
+	start(log);
+	// counted before running is read, so that shutdown waits for it
+	log->writers.fetch_add(1);
+	if (!log->running) {
+		log->writers.fetch_sub(1);
+		char text[TEXT_SIZE];
+		format(text, sizeof(text));
+		writeMessage(level, site, suppressed, text);
+		return;
+	}
+
+	size_t position = log->head.load(std::memory_order_relaxed);
+	Slot *slot;
+	for (;;) {
+		slot = &log->slots[position & (RING_SIZE - 1)];
+		size_t sequence = slot->sequence.load(
+			std::memory_order_acquire);
+		if (sequence == position) {
+			if (log->head.compare_exchange_weak(position,
+					position + 1,
+					std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (sequence < position) {
+			log->dropped.fetch_add(1, std::memory_order_relaxed);
+			log->writers.fetch_sub(1);
+			return;
+		} else {
+			position = log->head.load(std::memory_order_relaxed);
+		}
+	}
+	slot->level = level;
+	slot->site = site;
+	slot->suppressed = suppressed;
+	format(slot->text, TEXT_SIZE);
+	slot->sequence.store(position + 1, std::memory_order_release);
+	log->writers.fetch_sub(1);
+	wakeUp(log);
+}
+
+static void appendChar(char *text, size_t size, size_t *length, char ch)
+{
+	if (*length + 1 < size) {
+		text[(*length)++] = ch;
+		text[*length] = '\0';
+	}
+}
+
+static void appendString(char *text, size_t size, size_t *length,
+	const char *str)
+{
+	for (; *str != '\0'; str++) {
+		appendChar(text, size, length, *str);
+	}
+}
+
+// quoted if it would not read back as one value
+static void appendValue(char *text, size_t size, size_t *length,
+	const char *value)
+{
+	bool quote = *value == '\0';
+	for (const char *ch = value; *ch != '\0' && !quote; ch++) {
+		quote = *ch == ' ' || *ch == '"' || *ch == '=' ||
+			static_cast<unsigned char>(*ch) < 0x20;
+	}
+	if (!quote) {
+		appendString(text, size, length, value);
+		return;
+	}
+	appendChar(text, size, length, '"');
+	for (const char *ch = value; *ch != '\0'; ch++) {
+		if (*ch == '"' || *ch == '\\') {
+			appendChar(text, size, length, '\\');
+		}
+		appendChar(text, size, length, *ch);
+	}
+	appendChar(text, size, length, '"');
+}
+
+static void formatFields(char *text, size_t size, const char *event,
+	va_list args)
+{
+	size_t length = 0;
+	text[0] = '\0';
+	appendString(text, size, &length, event);
+	for (;;) {
+		const char *key = va_arg(args, const char *);
+		if (key == nullptr) {
+			break;
+		}
+		const char *value = va_arg(args, const char *);
+		appendChar(text, size, &length, ' ');
+		appendString(text, size, &length, key);
+		appendChar(text, size, &length, '=');
+		appendValue(text, size, &length,
+			value != nullptr ? value : "(null)");
+	}
+}
+
+extern "C" void nicolive_log_write(int level, const char *site,
+	const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	writeWith(level, site, [&](char *text, size_t size) {
+		std::vsnprintf(text, size, format, args);
+	});
+	va_end(args);
+}
+
+extern "C" void nicolive_log_write_fields(int level, const char *site,
+	const char *event, ...)
+{
+	va_list args;
+	va_start(args, event);
+	writeWith(level, site, [&](char *text, size_t size) {
+		formatFields(text, size, event, args);
+	});
+	va_end(args);
+}
+
+extern "C" void nicolive_log_shutdown(void)
+{
+	Logger *log = logger();
+	std::lock_guard<std::mutex> lock(log->threadMutex);
+	log->stopped = true;
+	log->running = false;
+	// later writers see running false, wait for the ones queueing now
+	while (log->writers > 0) {
+		std::this_thread::yield();
+	}
+	{
+		std::lock_guard<std::mutex> wakeLock(log->wakeMutex);
+		log->wake.notify_one();
+	}
+	if (log->thread.joinable()) {
+		log->thread.join();
+	}
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdbool.h>
+
+// Asynchronous logger behind the nicolive_log_* macros.
+// A message is formatted into a lock-free ring buffer and written to the
+// OBS log by a background thread, which also redacts cookies, tickets and
+// passwords. Each call site may log RATE_PER_SEC messages per second,
+// the rest are counted and reported with its next message.
+
+#define NICOLIVE_LOG_STR_(x) #x
+#define NICOLIVE_LOG_STR(x) NICOLIVE_LOG_STR_(x)
+// unique per call site and readable
+#define NICOLIVE_LOG_SITE __FILE__ ":" NICOLIVE_LOG_STR(__LINE__)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef __GNUC__
+#define NICOLIVE_LOG_PRINTF(fmt, va) __attribute__((format(printf, fmt, va)))
+#else
+#define NICOLIVE_LOG_PRINTF(fmt, va)
+#endif
+
+void nicolive_log_write(int level, const char *site, const char *format, ...)
+	NICOLIVE_LOG_PRINTF(3, 4);
+// key and value pairs of strings terminated by NULL:
+// nicolive_log_write_fields(LOG_INFO, site, "login", "result", "ok", NULL)
+// writes "login result=ok", a value with a space or a quote is quoted.
+// Formatted straight into the ring, and not at all when rate limited.
+void nicolive_log_write_fields(int level, const char *site,
+	const char *event, ...);
+// wait for the messages being queued, write out the queue and stop the
+// thread, later messages are written synchronously
+void nicolive_log_shutdown(void);
+
+#ifdef __cplusplus
+}
+#endif
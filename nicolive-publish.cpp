@@ -0,0 +1,276 @@
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <QtCore>
+#include <obs-module.h>
+#include "nicolive.h"
+#include "nicolive-publish.h"
+#include "nico-live.hpp"
+#include "nico-live-output-sampler.hpp"
+
+namespace {
+	const int RECONNECT_RETRIES = 20;
+	const int RECONNECT_DELAY_SEC = 10;
+
+	struct nicolive_extra_s {
+		// shared with a prepare in progress, deleted later
+		std::shared_ptr<NicoLive> nicolive;
+		std::string url;
+		std::string key;
+		obs_service_t *service = nullptr;
+		obs_output_t *output = nullptr;
+	};
+	struct nicolive_publish_s {
+		QStringList sessions;
+		std::vector<nicolive_extra_s> extras;
+		obs_weak_output_t *main_output = nullptr;
+		int traffic_mode = NICOLIVE_TRAFFIC_OFF;
+		std::string traffic_path;
+		std::string base_url;
+		// changed with the extras, a prepare of the former is dropped
+		unsigned long long generation = 0;
+	};
+	// the lives of the extras are found at prepare only, they are not
+	// watched for the next live as the main one is
+	std::unordered_map<void *, nicolive_publish_s> nicolive_publishes;
+	// settings update on the UI thread, activate and deactivate on the
+	// output threads
+	std::mutex nicolive_publishes_mutex;
+}
+
+static void delete_later(NicoLive *nicolive)
+{
+	nicolive->deleteLater();
+}
+
+static void set_extra_api(const nicolive_publish_s &publish, size_t index,
+	NicoLive *nicolive)
+{
+	nicolive->setApiBaseUrl(publish.base_url.c_str());
+	// each has its own accesses to record and replay
+	std::string path;
+	if (!publish.traffic_path.empty())
+		path = publish.traffic_path + ".extra" + std::to_string(index);
+	nicolive->setTraffic(publish.traffic_mode, path.c_str());
+}
+
+static void output_stopped(void *data, calldata_t *cd)
+{
+	const char *name = static_cast<const char *>(data);
+	long long code = calldata_int(cd, "code");
+	if (code != OBS_OUTPUT_SUCCESS)
+		nicolive_log_warn("publish: %s stopped with code %lld",
+			name, code);
+}
+
+static void stop_extra(nicolive_extra_s *extra)
+{
+	if (extra->output != nullptr) {
+		signal_handler_disconnect(
+			obs_output_get_signal_handler(extra->output),
+			"stop", output_stopped,
+			const_cast<char *>(obs_output_get_name(extra->output)));
+		obs_output_stop(extra->output);
+		obs_output_release(extra->output);
+		extra->output = nullptr;
+	}
+	if (extra->service != nullptr) {
+		obs_service_release(extra->service);
+		extra->service = nullptr;
+	}
+}
+
+static bool start_extra(nicolive_extra_s *extra, size_t index,
+	obs_output_t *main_output)
+{
+	std::string name = "nicolive_extra_" + std::to_string(index);
+
+	obs_data_t *settings = obs_data_create();
+	obs_data_set_string(settings, "server", extra->url.c_str());
+	obs_data_set_string(settings, "key", extra->key.c_str());
+	extra->service = obs_service_create("rtmp_custom", name.c_str(),
+		settings, nullptr);
+	obs_data_release(settings);
+	extra->output = obs_output_create("rtmp_output", name.c_str(),
+		nullptr, nullptr);
+	if (extra->service == nullptr || extra->output == nullptr) {
+		nicolive_log_error("publish: cannot create %s", name.c_str());
+		stop_extra(extra);
+		return false;
+	}
+
+	// share the encoders, so the program is encoded once
+	obs_output_set_service(extra->output, extra->service);
+	obs_output_set_video_encoder(extra->output,
+		obs_output_get_video_encoder(main_output));
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++) {
+		obs_encoder_t *audio_encoder =
+			obs_output_get_audio_encoder(main_output, i);
+		if (audio_encoder == nullptr)
+			break;
+		obs_output_set_audio_encoder(extra->output, audio_encoder, i);
+	}
+	obs_output_set_reconnect_settings(extra->output, RECONNECT_RETRIES,
+		RECONNECT_DELAY_SEC);
+	signal_handler_connect(obs_output_get_signal_handler(extra->output),
+		"stop", output_stopped,
+		const_cast<char *>(obs_output_get_name(extra->output)));
+
+	if (!obs_output_start(extra->output)) {
+		nicolive_log_warn("publish: cannot start %s: %s",
+			name.c_str(), extra->nicolive->getLiveId()
+				.toStdString().c_str());
+		stop_extra(extra);
+		return false;
+	}
+	nicolive_log_info("publish: start %s: %s", name.c_str(),
+		extra->nicolive->getLiveId().toStdString().c_str());
+	return true;
+}
+
+extern "C" void nicolive_publish_set_api(void *data, int traffic_mode,
+	const char *traffic_path, const char *base_url)
+{
+	std::lock_guard<std::mutex> lock(nicolive_publishes_mutex);
+	nicolive_publish_s &publish = nicolive_publishes[data];
+	publish.traffic_mode = traffic_mode;
+	publish.traffic_path = traffic_path != nullptr ? traffic_path : "";
+	publish.base_url = base_url != nullptr ? base_url : "";
+	for (size_t i = 0; i < publish.extras.size(); i++)
+		set_extra_api(publish, i, publish.extras[i].nicolive.get());
+}
+
+extern "C" void nicolive_publish_set_sessions(void *data,
+	const char *sessions)
+{
+	std::lock_guard<std::mutex> lock(nicolive_publishes_mutex);
+	nicolive_publish_s &publish = nicolive_publishes[data];
+	QStringList list;
+	for (const QString &line: QString(sessions).split('\n')) {
+		QString session = line.trimmed();
+		if (!session.isEmpty())
+			list.append(session);
+	}
+	if (list == publish.sessions)
+		return;
+
+	for (auto &extra: publish.extras)
+		stop_extra(&extra);
+	publish.extras.clear();
+	publish.sessions = list;
+	publish.generation++;
+	for (const QString &session: list) {
+		nicolive_extra_s extra;
+		extra.nicolive.reset(new NicoLive(), delete_later);
+		set_extra_api(publish, publish.extras.size(),
+			extra.nicolive.get());
+		extra.nicolive->setSession(session);
+		publish.extras.push_back(extra);
+	}
+}
+
+extern "C" long long nicolive_publish_prepare(void *data,
+	obs_output_t *output)
+{
+	std::vector<std::shared_ptr<NicoLive>> lives;
+	unsigned long long generation;
+	{
+		std::lock_guard<std::mutex> lock(nicolive_publishes_mutex);
+		auto found = nicolive_publishes.find(data);
+		if (found == nicolive_publishes.end())
+			return 0;
+		nicolive_publish_s &publish = found->second;
+		obs_weak_output_release(publish.main_output);
+		publish.main_output = obs_output_get_weak_output(output);
+		generation = publish.generation;
+		for (auto &extra: publish.extras) {
+			extra.url.clear();
+			extra.key.clear();
+			lives.push_back(extra.nicolive);
+		}
+	}
+
+	// The web accesses without the lock, which the output threads take
+	// to start and stop the extras. The settings, which may replace the
+	// extras or their transports, are updated on the UI thread as this.
+	std::vector<bool> on_air;
+	for (auto &live: lives)
+		on_air.push_back(live->checkSession() && live->checkLive());
+
+	std::lock_guard<std::mutex> lock(nicolive_publishes_mutex);
+	auto found = nicolive_publishes.find(data);
+	if (found == nicolive_publishes.end() ||
+			found->second.generation != generation) {
+		nicolive_log_warn("publish: extra accounts changed while "
+			"looking up their lives");
+		return 0;
+	}
+	long long bitrate = 0;
+	for (size_t i = 0; i < lives.size(); i++) {
+		nicolive_extra_s &extra = found->second.extras[i];
+		if (!on_air[i]) {
+			nicolive_log_warn("publish: no live of an extra "
+				"account");
+			continue;
+		}
+		extra.url = extra.nicolive->getLiveUrl().toStdString();
+		extra.key = extra.nicolive->getLiveKey().toStdString();
+		long long live_bitrate = extra.nicolive->getLiveBitrate();
+		if (live_bitrate > 0 && (bitrate == 0 || live_bitrate < bitrate))
+			bitrate = live_bitrate;
+	}
+	return bitrate;
+}
+
+extern "C" void nicolive_publish_start(void *data)
+{
+	std::lock_guard<std::mutex> lock(nicolive_publishes_mutex);
+	auto found = nicolive_publishes.find(data);
+	if (found == nicolive_publishes.end())
+		return;
+	nicolive_publish_s &publish = found->second;
+	obs_output_t *main_output =
+		obs_weak_output_get_output(publish.main_output);
+	if (main_output == nullptr)
+		return;
+
+	for (size_t i = 0; i < publish.extras.size(); i++) {
+		nicolive_extra_s &extra = publish.extras[i];
+		if (extra.url.empty())
+			continue;
+		stop_extra(&extra);
+		if (!start_extra(&extra, i, main_output))
+			continue;
+		// a broadcast summary for each upload too
+		extra.nicolive->getOutputSampler()->setOutput(extra.output);
+		extra.nicolive->startStreaming();
+	}
+	obs_output_release(main_output);
+}
+
+extern "C" void nicolive_publish_stop(void *data)
+{
+	std::lock_guard<std::mutex> lock(nicolive_publishes_mutex);
+	auto found = nicolive_publishes.find(data);
+	if (found == nicolive_publishes.end())
+		return;
+	for (auto &extra: found->second.extras) {
+		if (extra.output != nullptr)
+			extra.nicolive->stopStreaming();
+		stop_extra(&extra);
+	}
+}
+
+extern "C" void nicolive_publish_destroy(void *data)
+{
+	std::lock_guard<std::mutex> lock(nicolive_publishes_mutex);
+	auto found = nicolive_publishes.find(data);
+	if (found == nicolive_publishes.end())
+		return;
+	for (auto &extra: found->second.extras)
+		stop_extra(&extra);
+	obs_weak_output_release(found->second.main_output);
+	nicolive_publishes.erase(found);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <obs-module.h>
+
+// Publish the same encode to the lives of extra accounts. Each extra
+// account is a user_session, its live is looked up at initialize, and an
+// rtmp_output sharing the encoders of the main output streams to it from
+// activate to deactivate with its own reconnect settings. The extras use
+// the server and the traffic mode of the main account.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// mode is enum nicolive_traffic_mode, the traffic of the extra i is in
+// path.extra<i>, base_url is as nicolive_set_api_base_url
+void nicolive_publish_set_api(void *data, int traffic_mode,
+	const char *traffic_path, const char *base_url);
+// user_session values separated by lines
+void nicolive_publish_set_sessions(void *data, const char *sessions);
+// Looks up the lives of the extras, without holding the lock of start and
+// stop during the web accesses. Returns the smallest bitrate of the extra
+// lives, 0 if none is on air.
+long long nicolive_publish_prepare(void *data, obs_output_t *output);
+void nicolive_publish_start(void *data);
+void nicolive_publish_stop(void *data);
+void nicolive_publish_destroy(void *data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,273 @@
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <QtCore>
+#include <obs-module.h>
+#include "nicolive.h"
+#include "nicolive-signals.h"
+#include "nico-live.hpp"
+
+namespace {
+	// copied on the Qt thread, procedures may be called on any thread
+	struct nicolive_snapshot_s {
+		std::string live_id;
+		// without the ticket, which is the credential to publish
+		std::string live_url;
+		long long bitrate = 0;
+		long long start_time = 0;
+		long long end_time = 0;
+		bool exclude = false;
+		bool onair = false;
+		bool session_valid = false;
+		long long pubstat_changed = 0;
+		long long pubstat_unchanged = 0;
+		long long pubstat_failed = 0;
+		long long login_attempts = 0;
+		long long login_failures = 0;
+		long long transitions = 0;
+		long long offair_gap_count = 0;
+		long long offair_gap_msec_sum = 0;
+		long long offair_gap_msec_last = 0;
+	};
+	struct nicolive_instance_s {
+		NicoLive *nicolive;
+		obs_service_t *service;
+		nicolive_snapshot_s snapshot;
+	};
+	struct nicolive_signals_s {
+		std::mutex mutex;
+		std::vector<nicolive_instance_s> instances;
+	} nicolive_signals;
+}
+
+static const char *nicolive_signal_decls[] = {
+	"void nicolive_live_changed(ptr service, string live_id, "
+		"string previous_live_id)",
+	"void nicolive_live_ending(ptr service, string live_id, "
+		"int remaining)",
+	"void nicolive_session_invalid(ptr service)",
+	nullptr,
+};
+
+static long long to_unix_time(const QDateTime &time)
+{
+	return time.isValid() ? time.toMSecsSinceEpoch() / 1000 : 0;
+}
+
+static void take_snapshot(const NicoLive *nicolive,
+	nicolive_snapshot_s *snapshot)
+{
+	snapshot->live_id = nicolive->getLiveId().toStdString();
+	snapshot->live_url = nicolive->getLiveRtmpUrl().toStdString();
+	snapshot->bitrate = nicolive->getLiveBitrate();
+	snapshot->start_time = to_unix_time(nicolive->getLiveStartTime());
+	snapshot->end_time = to_unix_time(nicolive->getLiveEndTime());
+	snapshot->exclude = nicolive->isLiveExcluded();
+	snapshot->onair = nicolive->isOnair();
+	snapshot->session_valid = nicolive->enabledSession();
+	snapshot->pubstat_changed = nicolive->getPubStatChangedCount();
+	snapshot->pubstat_unchanged = nicolive->getPubStatUnchangedCount();
+	snapshot->pubstat_failed = nicolive->getPubStatFailedCount();
+	snapshot->login_attempts = nicolive->getLoginAttemptCount();
+	snapshot->login_failures = nicolive->getLoginFailureCount();
+	snapshot->transitions = nicolive->getTransitionCount();
+	snapshot->offair_gap_count = nicolive->getOffairGapCount();
+	snapshot->offair_gap_msec_sum = nicolive->getOffairGapMsecSum();
+	snapshot->offair_gap_msec_last = nicolive->getOffairGapMsecLast();
+}
+
+// must be called with the lock
+static nicolive_instance_s *find_instance(const NicoLive *nicolive)
+{
+	for (auto &instance: nicolive_signals.instances) {
+		if (instance.nicolive == nicolive)
+			return &instance;
+	}
+	return nullptr;
+}
+
+static void update_snapshot(const NicoLive *nicolive)
+{
+	nicolive_snapshot_s snapshot;
+	take_snapshot(nicolive, &snapshot);
+	std::lock_guard<std::mutex> lock(nicolive_signals.mutex);
+	nicolive_instance_s *instance = find_instance(nicolive);
+	if (instance != nullptr)
+		instance->snapshot = std::move(snapshot);
+}
+
+static obs_service_t *attached_service(const NicoLive *nicolive)
+{
+	std::lock_guard<std::mutex> lock(nicolive_signals.mutex);
+	nicolive_instance_s *instance = find_instance(nicolive);
+	return instance != nullptr ? instance->service : nullptr;
+}
+
+// the on air instance or else the last attached one
+static bool current_snapshot(nicolive_snapshot_s *snapshot)
+{
+	std::lock_guard<std::mutex> lock(nicolive_signals.mutex);
+	if (nicolive_signals.instances.empty())
+		return false;
+	for (auto &instance: nicolive_signals.instances) {
+		if (instance.snapshot.onair) {
+			*snapshot = instance.snapshot;
+			return true;
+		}
+	}
+	*snapshot = nicolive_signals.instances.back().snapshot;
+	return true;
+}
+
+static void get_live_info_proc(void *data, calldata_t *cd)
+{
+	UNUSED_PARAMETER(data);
+	nicolive_snapshot_s snapshot;
+	bool found = current_snapshot(&snapshot);
+
+	long long remaining = 0;
+	if (snapshot.onair && snapshot.end_time > 0) {
+		remaining = snapshot.end_time -
+			static_cast<long long>(std::time(nullptr));
+		if (remaining < 0)
+			remaining = 0;
+	}
+
+	calldata_set_bool(cd, "found", found);
+	calldata_set_string(cd, "live_id", snapshot.live_id.c_str());
+	calldata_set_string(cd, "live_url", snapshot.live_url.c_str());
+	calldata_set_int(cd, "bitrate", snapshot.bitrate);
+	calldata_set_int(cd, "start_time", snapshot.start_time);
+	calldata_set_int(cd, "end_time", snapshot.end_time);
+	calldata_set_int(cd, "remaining", remaining);
+	calldata_set_bool(cd, "exclude", snapshot.exclude);
+	calldata_set_bool(cd, "onair", snapshot.onair);
+	calldata_set_bool(cd, "session_valid", snapshot.session_valid);
+}
+
+static void get_stats_proc(void *data, calldata_t *cd)
+{
+	UNUSED_PARAMETER(data);
+	nicolive_snapshot_s snapshot;
+	bool found = current_snapshot(&snapshot);
+
+	calldata_set_bool(cd, "found", found);
+	calldata_set_int(cd, "pubstat_changed", snapshot.pubstat_changed);
+	calldata_set_int(cd, "pubstat_unchanged", snapshot.pubstat_unchanged);
+	calldata_set_int(cd, "pubstat_failed", snapshot.pubstat_failed);
+	calldata_set_int(cd, "login_attempts", snapshot.login_attempts);
+	calldata_set_int(cd, "login_failures", snapshot.login_failures);
+	calldata_set_int(cd, "transitions", snapshot.transitions);
+	calldata_set_int(cd, "offair_gap_count", snapshot.offair_gap_count);
+	calldata_set_int(cd, "offair_gap_msec_sum",
+		snapshot.offair_gap_msec_sum);
+	calldata_set_int(cd, "offair_gap_msec_last",
+		snapshot.offair_gap_msec_last);
+}
+
+extern "C" void nicolive_signals_register(void)
+{
+	signal_handler_t *handler = obs_get_signal_handler();
+	for (const char **decl = nicolive_signal_decls; *decl != nullptr;
+			decl++) {
+		if (!signal_handler_add(handler, *decl))
+			nicolive_log_warn("failed to add signal: %s", *decl);
+	}
+
+	proc_handler_t *procs = obs_get_proc_handler();
+	proc_handler_add(procs,
+		"void nicolive_get_live_info(out bool found, "
+		"out string live_id, out string live_url, out int bitrate, "
+		"out int start_time, out int end_time, out int remaining, "
+		"out bool exclude, out bool onair, out bool session_valid)",
+		get_live_info_proc, nullptr);
+	proc_handler_add(procs,
+		"void nicolive_get_stats(out bool found, "
+		"out int pubstat_changed, out int pubstat_unchanged, "
+		"out int pubstat_failed, out int login_attempts, "
+		"out int login_failures, out int transitions, "
+		"out int offair_gap_count, out int offair_gap_msec_sum, "
+		"out int offair_gap_msec_last)",
+		get_stats_proc, nullptr);
+}
+
+extern "C" void nicolive_signals_attach(void *data, obs_service_t *service)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	{
+		nicolive_instance_s instance;
+		instance.nicolive = nicolive;
+		instance.service = service;
+		take_snapshot(nicolive, &instance.snapshot);
+		std::lock_guard<std::mutex> lock(nicolive_signals.mutex);
+		nicolive_signals.instances.push_back(std::move(instance));
+	}
+
+	// the receiver is nicolive, so these are disconnected on deletion
+	QObject::connect(nicolive, &NicoLive::statsChanged, nicolive,
+		[nicolive]() {
+			update_snapshot(nicolive);
+		});
+	QObject::connect(nicolive, &NicoLive::liveInfoChanged, nicolive,
+		[nicolive]() {
+			update_snapshot(nicolive);
+		});
+	QObject::connect(nicolive, &NicoLive::liveChanged, nicolive,
+		[nicolive](const QString &liveId,
+			const QString &previousLiveId) {
+			obs_service_t *service = attached_service(nicolive);
+			if (service == nullptr)
+				return;
+			calldata_t cd;
+			calldata_init(&cd);
+			calldata_set_ptr(&cd, "service", service);
+			calldata_set_string(&cd, "live_id",
+				liveId.toStdString().c_str());
+			calldata_set_string(&cd, "previous_live_id",
+				previousLiveId.toStdString().c_str());
+			signal_handler_signal(obs_get_signal_handler(),
+				"nicolive_live_changed", &cd);
+			calldata_free(&cd);
+		});
+	QObject::connect(nicolive, &NicoLive::liveEnding, nicolive,
+		[nicolive](const QString &liveId, int remainingSec) {
+			obs_service_t *service = attached_service(nicolive);
+			if (service == nullptr)
+				return;
+			calldata_t cd;
+			calldata_init(&cd);
+			calldata_set_ptr(&cd, "service", service);
+			calldata_set_string(&cd, "live_id",
+				liveId.toStdString().c_str());
+			calldata_set_int(&cd, "remaining", remainingSec);
+			signal_handler_signal(obs_get_signal_handler(),
+				"nicolive_live_ending", &cd);
+			calldata_free(&cd);
+		});
+	QObject::connect(nicolive, &NicoLive::sessionInvalid, nicolive,
+		[nicolive]() {
+			obs_service_t *service = attached_service(nicolive);
+			if (service == nullptr)
+				return;
+			calldata_t cd;
+			calldata_init(&cd);
+			calldata_set_ptr(&cd, "service", service);
+			signal_handler_signal(obs_get_signal_handler(),
+				"nicolive_session_invalid", &cd);
+			calldata_free(&cd);
+		});
+}
+
+extern "C" void nicolive_signals_detach(void *data)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	std::lock_guard<std::mutex> lock(nicolive_signals.mutex);
+	auto &instances = nicolive_signals.instances;
+	for (auto it = instances.begin(); it != instances.end(); ++it) {
+		if (it->nicolive == nicolive) {
+			instances.erase(it);
+			break;
+		}
+	}
+}
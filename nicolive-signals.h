@@ -0,0 +1,28 @@
+#pragma once
+
+#include <obs-module.h>
+
+// Global OBS signals and procedures of the live state. libobs does not
+// expose the handlers of a service, so they are added on the core handlers
+// with the "nicolive_" prefix and the service as the "service" parameter.
+//
+// signals:
+//   nicolive_live_changed(ptr service, string live_id,
+//           string previous_live_id)
+//   nicolive_live_ending(ptr service, string live_id, int remaining)
+//   nicolive_session_invalid(ptr service)
+// procedures, about the service on air or else the last created one:
+//   nicolive_get_live_info
+//   nicolive_get_stats
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void nicolive_signals_register(void);
+void nicolive_signals_attach(void *data, obs_service_t *service);
+void nicolive_signals_detach(void *data);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <util/bmem.h>
+#include <util/platform.h>
+#include "nicolive.h"
+#include "nicolive-trace.h"
+
+namespace {
+	struct nicolive_trace_s {
+		std::mutex mutex;
+		FILE *file = nullptr;
+		bool opened = false;
+		std::chrono::steady_clock::time_point start_time;
+		std::unordered_map<std::thread::id, int> thread_ids;
+	} nicolive_trace;
+}
+
+static bool open_trace_file()
+{
+	nicolive_trace.opened = true;
+	char *log_dir = os_get_config_path_ptr("obs-studio/logs");
+	if (log_dir == nullptr) {
+		nicolive_log_warn("trace: cannot find log directory");
+		return false;
+	}
+	os_mkdirs(log_dir);
+
+	char file_name[64];
+	std::time_t now = std::time(nullptr);
+	std::strftime(file_name, sizeof(file_name),
+			"nicolive-trace-%Y-%m-%d-%H-%M-%S.json",
+			std::localtime(&now));
+	std::string path = std::string(log_dir) + "/" + file_name;
+	bfree(log_dir);
+
+	nicolive_trace.file = os_fopen(path.c_str(), "wb");
+	if (nicolive_trace.file == nullptr) {
+		nicolive_log_warn("trace: cannot open %s", path.c_str());
+		return false;
+	}
+	nicolive_log_info("trace to %s", path.c_str());
+	nicolive_trace.start_time = std::chrono::steady_clock::now();
+	// the closing bracket is optional for trace viewers
+	std::fputs("[\n", nicolive_trace.file);
+	return true;
+}
+
+extern "C" void nicolive_trace_event(const char *name, char phase)
+{
+	auto now = std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(nicolive_trace.mutex);
+	if (!nicolive_trace.opened && !open_trace_file())
+		return;
+	if (nicolive_trace.file == nullptr)
+		return;
+
+	auto found = nicolive_trace.thread_ids.emplace(
+			std::this_thread::get_id(),
+			static_cast<int>(nicolive_trace.thread_ids.size()) + 1);
+	long long ts = std::chrono::duration_cast<std::chrono::microseconds>(
+			now - nicolive_trace.start_time).count();
+	std::fprintf(nicolive_trace.file,
+			"{\"name\":\"%s\",\"cat\":\"nicolive\",\"ph\":\"%c\","
+			"\"ts\":%lld,\"pid\":1,\"tid\":%d},\n",
+			name, phase, ts, found.first->second);
+	// keep the trace readable after a crash
+	std::fflush(nicolive_trace.file);
+}
+
+extern "C" void nicolive_trace_close_file(void)
+{
+	std::lock_guard<std::mutex> lock(nicolive_trace.mutex);
+	if (nicolive_trace.file == nullptr)
+		return;
+	std::fputs("{}]\n", nicolive_trace.file);
+	std::fclose(nicolive_trace.file);
+	nicolive_trace.file = nullptr;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+
+// Chrome trace_event tracing of the stream lifecycle, written to
+// nicolive-trace-<date>.json in the OBS log directory. Built only with
+// -DNICOLIVE_TRACE, otherwise the macros are empty.
+
+#ifdef NICOLIVE_TRACE
+#define nicolive_trace_begin(name) nicolive_trace_event((name), 'B')
+#define nicolive_trace_end(name) nicolive_trace_event((name), 'E')
+#define nicolive_trace_close() nicolive_trace_close_file()
+#else
+#define nicolive_trace_begin(name)
+#define nicolive_trace_end(name)
+#define nicolive_trace_close()
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void nicolive_trace_event(const char *name, char phase);
+void nicolive_trace_close_file(void);
+
+#ifdef __cplusplus
+}
+
+#ifdef NICOLIVE_TRACE
+class NicoLiveTraceScope {
+	const char *name;
+public:
+	NicoLiveTraceScope(const char *name) : name(name)
+	{
+		nicolive_trace_event(this->name, 'B');
+	}
+	~NicoLiveTraceScope()
+	{
+		nicolive_trace_event(this->name, 'E');
+	}
+};
+#define nicolive_trace_scope_concat(a, b) a##b
+#define nicolive_trace_scope_line(name, line) \
+		NicoLiveTraceScope nicolive_trace_scope_concat( \
+			nicolive_trace_scope_, line)(name)
+#define nicolive_trace_scope(name) \
+		nicolive_trace_scope_line((name), __LINE__)
+#else
+#define nicolive_trace_scope(name)
+#endif
+#endif
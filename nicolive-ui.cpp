@@ -1,110 +1,124 @@
 #include <QtCore>
 #include <QtWidgets>
 #include <obs-module.h>
+#include <obs-frontend-api.h>
 #include "nicolive.h"
 #include "nicolive-ui.h"
+#include "nico-live-notifier.hpp"
 
-static QWidget *findTopLevelWidget(const char *name) {
-	for(QWidget *widget: QApplication::topLevelWidgets()) {
-		if (widget->objectName() == name) {
-			return widget;
-		}
-	}
-	return nullptr;
-}
+// wait for the server to close the previous live before restarting
+static const int RESTART_DELAY_MSEC = 1000;
+static bool restart_pending = false;
 
-static QWidget *getActiveWindowWidget() {
-	for(QWidget *widget: QApplication::topLevelWidgets()) {
-		if (widget->isActiveWindow()) {
-			nicolive_log_debug("active window: %s",
-				widget->objectName().toStdString().c_str());
-			return widget;
-		}
+static NicoLiveNotifier *notifier = nullptr;
+
+static void post_notice(NicoLiveNotifier::Level level, const char *message)
+{
+	if (notifier == nullptr) {
+		nicolive_log_error("notifier is not loaded: %s", message);
+		return;
 	}
-	return nullptr;
+	notifier->post(level, QString(message));
 }
 
 extern "C" void nicolive_mbox_error(const char *message)
 {
-	QWidget *parent;
-	parent = getActiveWindowWidget();
-	if (parent != nullptr) {
-		QMessageBox::critical(parent,
-				QString(obs_module_text("MessageTitleError")),
-				QString(message));
-	} else {
-		nicolive_log_error("not found Qt Active Window");
-	}
+	post_notice(NicoLiveNotifier::Level::CRITICAL, message);
 }
 
 extern "C" void nicolive_mbox_warn(const char *message)
 {
-	QWidget *parent;
-	parent = getActiveWindowWidget();
-	if (parent != nullptr) {
-		QMessageBox::warning(parent,
-				QString(obs_module_text("MessageTitleWarn")),
-				QString(message));
-	} else {
-		nicolive_log_error("not found Qt Active Window");
-	}
+	post_notice(NicoLiveNotifier::Level::WARNING, message);
 }
 
 extern "C" void nicolive_mbox_info(const char *message)
 {
-	QWidget *parent;
-	parent = getActiveWindowWidget();
-	if (parent != nullptr) {
-		QMessageBox::information(parent,
-				QString(obs_module_text("MessageTitleInfo")),
-				QString(message));
-	} else {
-		nicolive_log_error("not found Qt Active Window");
-	}
+	post_notice(NicoLiveNotifier::Level::INFORMATION, message);
 }
 
 extern "C" void nicolive_msg_error(bool available_gui, const char *gui_message,
 		const char *cui_message)
 {
+	nicolive_log_error("%s", cui_message);
 	if (available_gui)
 		nicolive_mbox_error(gui_message);
-	else
-		nicolive_log_error("%s", cui_message);
 }
 
 extern "C" void nicolive_msg_warn(bool available_gui, const char *gui_message,
 		const char *cui_message)
 {
+	nicolive_log_warn("%s", cui_message);
 	if (available_gui)
 		nicolive_mbox_warn(gui_message);
-	else
-		nicolive_log_warn("%s", cui_message);
 }
 
 extern "C" void nicolive_msg_info(bool available_gui, const char *gui_message,
 		const char *cui_message)
 {
+	nicolive_log_info("%s", cui_message);
 	if (available_gui)
 		nicolive_mbox_info(gui_message);
-	else
-		nicolive_log_info("%s", cui_message);
 }
 
-extern "C" void nicolive_streaming_click()
+static void streaming_event(enum obs_frontend_event event, void *data)
+{
+	UNUSED_PARAMETER(data);
+	if (event != OBS_FRONTEND_EVENT_STREAMING_STOPPED)
+		return;
+	if (!restart_pending)
+		return;
+
+	restart_pending = false;
+	nicolive_log_debug("restart streaming after stopped");
+	QTimer::singleShot(RESTART_DELAY_MSEC, []() {
+		if (!obs_frontend_streaming_active())
+			obs_frontend_streaming_start();
+	});
+}
+
+extern "C" void nicolive_ui_load(void)
+{
+	notifier = new NicoLiveNotifier(static_cast<QWidget *>(
+		obs_frontend_get_main_window()));
+	obs_frontend_add_event_callback(streaming_event, nullptr);
+}
+
+extern "C" void nicolive_ui_unload(void)
+{
+	obs_frontend_remove_event_callback(streaming_event, nullptr);
+	delete notifier;
+	notifier = nullptr;
+}
+
+extern "C" void nicolive_streaming_start(void)
 {
-	QWidget *obs_widget = findTopLevelWidget("OBSBasic");
-	if (obs_widget == nullptr) {
-		nicolive_log_error("not found OBSBasic Window");
+	if (obs_frontend_streaming_active()) {
+		nicolive_log_debug("streaming is already active");
 		return;
 	}
+	nicolive_log_debug("start streaming");
+	obs_frontend_streaming_start();
+}
 
-	QPushButton *stream_button = obs_widget->findChild<QPushButton *>(
-		"streamButton");
-	if (stream_button == nullptr) {
-		nicolive_log_error("not found streamButton");
+extern "C" void nicolive_streaming_stop(void)
+{
+	restart_pending = false;
+	if (!obs_frontend_streaming_active()) {
+		nicolive_log_debug("streaming is already inactive");
 		return;
 	}
+	nicolive_log_debug("stop streaming");
+	obs_frontend_streaming_stop();
+}
 
-	nicolive_log_debug("click streamButton");
-	stream_button->click();
+extern "C" void nicolive_streaming_restart(void)
+{
+	if (!obs_frontend_streaming_active()) {
+		nicolive_streaming_start();
+		return;
+	}
+	// start again on OBS_FRONTEND_EVENT_STREAMING_STOPPED
+	nicolive_log_debug("stop streaming for restart");
+	restart_pending = true;
+	obs_frontend_streaming_stop();
 }
@@ -17,7 +17,12 @@ void nicolive_msg_warn(bool available_gui, const char *gui_message,
 void nicolive_msg_info(bool available_gui, const char *gui_message,
 		const char *cui_message);
 
-void nicolive_streaming_click(void);
+void nicolive_ui_load(void);
+void nicolive_ui_unload(void);
+
+void nicolive_streaming_start(void);
+void nicolive_streaming_stop(void);
+void nicolive_streaming_restart(void);
 
 #ifdef __cplusplus
 }
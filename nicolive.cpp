@@ -2,6 +2,9 @@
 #include <obs-module.h>
 #include "nicolive.h"
 #include "nico-live.hpp"
+#include "nico-live-output-sampler.hpp"
+#include "nico-live-auto-tune.hpp"
+#include "nico-live-bitrate-budget.hpp"
 
 // cannot use anonymouse struct because VS2013 bug
 // https://connect.microsoft.com/VisualStudio/feedback/details/808506/nsdmi-silently-ignored-on-nested-anonymous-classes-and-structs
@@ -42,6 +45,62 @@ extern "C" void nicolive_set_enabled_adjust_bitrate(void *data, bool enabled)
 	nicolive->setEnabledAdjustBitrate(enabled);
 }
 
+extern "C" void nicolive_set_enabled_hedge_request(void *data, bool enabled)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	nicolive->setEnabledHedgeRequest(enabled);
+}
+
+extern "C" void nicolive_set_enabled_lower_audio(void *data, bool enabled)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	nicolive->setEnabledLowerAudio(enabled);
+}
+
+extern "C" void nicolive_set_enabled_adaptive_bitrate(void *data,
+	bool enabled)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	nicolive->setEnabledAdaptiveBitrate(enabled);
+}
+
+extern "C" void nicolive_set_enabled_auto_tune(void *data, bool enabled)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	nicolive->setEnabledAutoTune(enabled);
+}
+
+extern "C" void nicolive_set_enabled_bandwidth_probe(void *data,
+	bool enabled)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	nicolive->setEnabledBandwidthProbe(enabled);
+}
+
+extern "C" void nicolive_set_traffic(void *data, int mode, const char *path)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	nicolive->setTraffic(mode, path);
+}
+
+extern "C" void nicolive_set_api_base_url(void *data, const char *base_url)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	nicolive->setApiBaseUrl(base_url);
+}
+
+extern "C" bool nicolive_set_metrics_port(void *data, int port)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	return nicolive->setMetricsPort(port);
+}
+
+extern "C" void nicolive_set_output(void *data, struct obs_output *output)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	nicolive->getOutputSampler()->setOutput(output);
+}
+
 extern "C" const char *nicolive_get_mail(const void *data)
 {
 	const NicoLive *nicolive = static_cast<const NicoLive *>(data);
@@ -101,12 +160,47 @@ extern "C" long long nicolive_get_live_bitrate(const void *data)
 	return nicolive->getLiveBitrate();
 }
 
+extern "C" void nicolive_get_tuning(const void *data,
+	struct nicolive_tuning *tuning)
+{
+	const NicoLive *nicolive = static_cast<const NicoLive *>(data);
+	NicoLiveAutoTune::Tuning chosen = nicolive->getAutoTune()->choose(
+			nicolive->getLiveBitrate());
+	tuning->height = chosen.height;
+	tuning->preset = chosen.preset;
+	tuning->rate_control = chosen.rateControl;
+}
+
+extern "C" long long nicolive_get_safe_bitrate(void *data)
+{
+	NicoLive *nicolive = static_cast<NicoLive *>(data);
+	return nicolive->getSafeBitrate();
+}
+
 extern "C" bool nicolive_enabled_adjust_bitrate(const void *data)
 {
 	const NicoLive *nicolive = static_cast<const NicoLive *>(data);
 	return nicolive->enabledAdjustBitrate();
 }
 
+extern "C" bool nicolive_enabled_lower_audio(const void *data)
+{
+	const NicoLive *nicolive = static_cast<const NicoLive *>(data);
+	return nicolive->enabledLowerAudio();
+}
+
+extern "C" bool nicolive_enabled_auto_tune(const void *data)
+{
+	const NicoLive *nicolive = static_cast<const NicoLive *>(data);
+	return nicolive->enabledAutoTune();
+}
+
+extern "C" bool nicolive_enabled_bandwidth_probe(const void *data)
+{
+	const NicoLive *nicolive = static_cast<const NicoLive *>(data);
+	return nicolive->enabledBandwidthProbe();
+}
+
 extern "C" bool nicolive_load_viqo_settings(void *data)
 {
 	NicoLive *nicolive = static_cast<NicoLive *>(data);
@@ -154,3 +248,16 @@ extern "C" bool nicolive_silent_once(void *data)
 	NicoLive *nicolive = static_cast<NicoLive *>(data);
 	return nicolive->silentOnce();
 }
+
+extern "C" bool nicolive_plan_bitrate(long long cap,
+	const long long *audio_bitrates, size_t count, bool lower_audio,
+	long long *video_bitrate, long long *planned_audio_bitrates)
+{
+	NicoLiveBitrateBudget::Plan plan = NicoLiveBitrateBudget::plan(cap,
+		std::vector<long long>(audio_bitrates, audio_bitrates + count),
+		lower_audio);
+	*video_bitrate = plan.videoKbps;
+	for (size_t i = 0; i < count; i++)
+		planned_audio_bitrates[i] = plan.audioKbps[i];
+	return plan.ok;
+}
@@ -1,21 +1,30 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <util/base.h>
+#include "nicolive-log.h"
 
 #ifndef __func__
 #define __func__ __FUNCTION__
 #endif
 #define nicolive_log_error(format, ...) \
-		blog(LOG_ERROR, "[nicolive] " format, ##__VA_ARGS__)
+		nicolive_log_write(LOG_ERROR, NICOLIVE_LOG_SITE, \
+			format, ##__VA_ARGS__)
 #define nicolive_log_warn(format, ...) \
-		blog(LOG_WARNING, "[nicolive] " format, ##__VA_ARGS__)
+		nicolive_log_write(LOG_WARNING, NICOLIVE_LOG_SITE, \
+			format, ##__VA_ARGS__)
 #define nicolive_log_info(format, ...) \
-		blog(LOG_INFO, "[nicolive] " format, ##__VA_ARGS__)
+		nicolive_log_write(LOG_INFO, NICOLIVE_LOG_SITE, \
+			format, ##__VA_ARGS__)
+#define nicolive_log_fields(level, event, ...) \
+		nicolive_log_write_fields((level), NICOLIVE_LOG_SITE, \
+			(event), __VA_ARGS__, (const char *)0)
 
 #ifdef _DEBUG
 #define nicolive_log_debug(format, ...) \
-		blog(LOG_DEBUG, "[nicolive] " format, ##__VA_ARGS__)
+		nicolive_log_write(LOG_DEBUG, NICOLIVE_LOG_SITE, \
+			format, ##__VA_ARGS__)
 #define nicolive_log_debug_call_func() \
 		nicolive_log_debug("call func: %s", __func__)
 #else
@@ -27,12 +36,36 @@
 extern "C" {
 #endif
 
+struct obs_output;
+
+struct nicolive_tuning {
+	int height; // 0 for no scaling
+	const char *preset; // x264 preset
+	const char *rate_control;
+};
+
+enum nicolive_traffic_mode {
+	NICOLIVE_TRAFFIC_OFF,
+	NICOLIVE_TRAFFIC_RECORD,
+	NICOLIVE_TRAFFIC_REPLAY,
+	NICOLIVE_TRAFFIC_REPLAY_TIMED,
+};
+
 void *nicolive_create(void);
 void nicolive_destroy(void *data);
 
 void nicolive_set_settings(void *data, const char *mail, const char *password,
 	const char *session);
 void nicolive_set_enabled_adjust_bitrate(void *data, bool enabled);
+void nicolive_set_enabled_hedge_request(void *data, bool enabled);
+void nicolive_set_enabled_lower_audio(void *data, bool enabled);
+void nicolive_set_enabled_adaptive_bitrate(void *data, bool enabled);
+void nicolive_set_enabled_auto_tune(void *data, bool enabled);
+void nicolive_set_enabled_bandwidth_probe(void *data, bool enabled);
+void nicolive_set_traffic(void *data, int mode, const char *path);
+void nicolive_set_api_base_url(void *data, const char *base_url);
+bool nicolive_set_metrics_port(void *data, int port);
+void nicolive_set_output(void *data, struct obs_output *output);
 
 const char *nicolive_get_mail(const void *data);
 const char *nicolive_get_password(const void *data);
@@ -40,8 +73,14 @@ const char *nicolive_get_session(const void *data);
 const char *nicolive_get_live_url(const void *data);
 const char *nicolive_get_live_key(const void *data);
 long long nicolive_get_live_bitrate(const void *data);
+long long nicolive_get_safe_bitrate(void *data);
+
+void nicolive_get_tuning(const void *data, struct nicolive_tuning *tuning);
 
 bool nicolive_enabled_adjust_bitrate(const void *data);
+bool nicolive_enabled_lower_audio(const void *data);
+bool nicolive_enabled_auto_tune(const void *data);
+bool nicolive_enabled_bandwidth_probe(const void *data);
 
 bool nicolive_load_viqo_settings(void *data);
 bool nicolive_check_session(void *data);
@@ -55,6 +94,12 @@ void nicolive_stop_watching(void *data);
 
 bool nicolive_silent_once(void *data);
 
+// split the cap across the video and count audio tracks, false if the
+// video would be under the minimum
+bool nicolive_plan_bitrate(long long cap, const long long *audio_bitrates,
+	size_t count, bool lower_audio, long long *video_bitrate,
+	long long *planned_audio_bitrates);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,7 +1,11 @@
 #include <stdbool.h>
+#include <string.h>
 #include <obs-module.h>
 #include "nicolive.h"
 #include "nicolive-ui.h"
+#include "nicolive-trace.h"
+#include "nicolive-signals.h"
+#include "nicolive-publish.h"
 
 // use in rtmp_nicolive_update_internal for reset default settigs
 #define reset_obs_data(type, settings, name) \
@@ -14,41 +18,236 @@ enum rtmp_nicolive_login_type {
 	RTMP_NICOLIVE_LOGIN_VIQO,
 };
 
+// encoder settings changed for one streaming session, put back at
+// deactivate so that the settings saved by the user stay as they were
+struct session_encoders {
+	void *owner;
+	obs_weak_encoder_t *video_encoder;
+	long long video_bitrate; // -1 if the user did not set it
+	char *preset; // NULL if the user did not set it
+	char *rate_control;
+	uint32_t scaled_width; // 0 if not scaled
+	uint32_t scaled_height;
+	obs_weak_encoder_t *audio_encoders[MAX_AUDIO_MIXES];
+	long long audio_bitrates[MAX_AUDIO_MIXES];
+	size_t audio_count;
+};
+
+static struct session_encoders session_encoders;
+
+static long long save_int(obs_data_t *settings, const char *name)
+{
+	if (!obs_data_has_user_value(settings, name))
+		return -1;
+	return obs_data_get_int(settings, name);
+}
+
+static void restore_int(obs_data_t *settings, const char *name,
+		long long value)
+{
+	if (value >= 0)
+		obs_data_set_int(settings, name, value);
+	else
+		obs_data_erase(settings, name);
+}
+
+static char *save_string(obs_data_t *settings, const char *name)
+{
+	if (!obs_data_has_user_value(settings, name))
+		return NULL;
+	return bstrdup(obs_data_get_string(settings, name));
+}
+
+static void restore_string(obs_data_t *settings, const char *name,
+		const char *value)
+{
+	if (value)
+		obs_data_set_string(settings, name, value);
+	else
+		obs_data_erase(settings, name);
+}
+
+static void clear_session_encoders(void)
+{
+	obs_weak_encoder_release(session_encoders.video_encoder);
+	for (size_t i = 0; i < session_encoders.audio_count; i++)
+		obs_weak_encoder_release(session_encoders.audio_encoders[i]);
+	bfree(session_encoders.preset);
+	bfree(session_encoders.rate_control);
+	memset(&session_encoders, 0, sizeof(session_encoders));
+}
 
-static bool adjust_bitrate(obs_output_t *output, long long bitrate)
+static void save_session_encoders(void *data, obs_output_t *output)
 {
 	obs_encoder_t *video_encoder = obs_output_get_video_encoder(output);
-	// get audio 0
-	obs_encoder_t *audio_encoder = obs_output_get_audio_encoder(output, 0);
-	obs_data_t *video_encoder_settings =
-			obs_encoder_get_settings(video_encoder);
-	obs_data_t *audio_encoder_settings =
-			obs_encoder_get_settings(audio_encoder);
+	obs_data_t *settings;
+
+	clear_session_encoders();
+	if (!video_encoder)
+		return;
+	session_encoders.owner = data;
+	session_encoders.video_encoder =
+			obs_encoder_get_weak_encoder(video_encoder);
+	settings = obs_encoder_get_settings(video_encoder);
+	session_encoders.video_bitrate = save_int(settings, "bitrate");
+	session_encoders.preset = save_string(settings, "preset");
+	session_encoders.rate_control = save_string(settings, "rate_control");
+	obs_data_release(settings);
+	if (obs_encoder_scaling_enabled(video_encoder)) {
+		session_encoders.scaled_width =
+				obs_encoder_get_width(video_encoder);
+		session_encoders.scaled_height =
+				obs_encoder_get_height(video_encoder);
+	}
+
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++) {
+		obs_encoder_t *audio_encoder =
+				obs_output_get_audio_encoder(output, i);
+		if (!audio_encoder)
+			break;
+		session_encoders.audio_encoders[i] =
+				obs_encoder_get_weak_encoder(audio_encoder);
+		settings = obs_encoder_get_settings(audio_encoder);
+		session_encoders.audio_bitrates[i] =
+				save_int(settings, "bitrate");
+		obs_data_release(settings);
+		session_encoders.audio_count++;
+	}
+}
+
+static void restore_session_encoders(void *data)
+{
+	obs_encoder_t *video_encoder;
+	obs_data_t *settings;
+
+	if (session_encoders.owner != data)
+		return;
+	video_encoder = obs_weak_encoder_get_encoder(
+			session_encoders.video_encoder);
+	if (video_encoder) {
+		settings = obs_encoder_get_settings(video_encoder);
+		restore_int(settings, "bitrate",
+				session_encoders.video_bitrate);
+		restore_string(settings, "preset", session_encoders.preset);
+		restore_string(settings, "rate_control",
+				session_encoders.rate_control);
+		obs_encoder_update(video_encoder, settings);
+		obs_data_release(settings);
+		obs_encoder_set_scaled_size(video_encoder,
+				session_encoders.scaled_width,
+				session_encoders.scaled_height);
+		obs_encoder_release(video_encoder);
+	}
+	for (size_t i = 0; i < session_encoders.audio_count; i++) {
+		obs_encoder_t *audio_encoder = obs_weak_encoder_get_encoder(
+				session_encoders.audio_encoders[i]);
+		if (!audio_encoder)
+			continue;
+		settings = obs_encoder_get_settings(audio_encoder);
+		restore_int(settings, "bitrate",
+				session_encoders.audio_bitrates[i]);
+		obs_encoder_update(audio_encoder, settings);
+		obs_data_release(settings);
+		obs_encoder_release(audio_encoder);
+	}
+	nicolive_log_info("restore encoder settings");
+	clear_session_encoders();
+}
 
-	long long video_bitrate = obs_data_get_int(video_encoder_settings,
-			"bitrate");
-	long long audio_bitrate = obs_data_get_int(audio_encoder_settings,
-			"bitrate");
+static bool adjust_bitrate(obs_output_t *output, long long bitrate,
+		bool lower_audio)
+{
+	obs_encoder_t *video_encoder = obs_output_get_video_encoder(output);
+	obs_encoder_t *audio_encoders[MAX_AUDIO_MIXES];
+	long long audio_bitrates[MAX_AUDIO_MIXES];
+	long long planned_audio_bitrates[MAX_AUDIO_MIXES];
+	long long video_bitrate;
+	long long planned_video_bitrate;
+	obs_data_t *encoder_settings;
+	size_t count = 0;
+
+	// every audio track of the output shares the budget
+	for (size_t i = 0; i < MAX_AUDIO_MIXES; i++) {
+		obs_encoder_t *audio_encoder =
+				obs_output_get_audio_encoder(output, i);
+		if (!audio_encoder)
+			break;
+		encoder_settings = obs_encoder_get_settings(audio_encoder);
+		audio_encoders[count] = audio_encoder;
+		audio_bitrates[count] = obs_data_get_int(encoder_settings,
+				"bitrate");
+		obs_data_release(encoder_settings);
+		count++;
+	}
 
-	// the smallest video bitrate is 200?
-	if (bitrate - audio_bitrate < 200) {
+	if (!nicolive_plan_bitrate(bitrate, audio_bitrates, count,
+			lower_audio, &planned_video_bitrate,
+			planned_audio_bitrates)) {
 		nicolive_log_warn("audio bitrate is too large");
 		return false;
 	}
 
-	if (bitrate != video_bitrate + audio_bitrate) {
-		obs_data_set_int(video_encoder_settings, "bitrate",
-			bitrate - audio_bitrate);
-		obs_encoder_update(video_encoder, video_encoder_settings);
+	for (size_t i = 0; i < count; i++) {
+		if (planned_audio_bitrates[i] == audio_bitrates[i])
+			continue;
+		encoder_settings = obs_encoder_get_settings(audio_encoders[i]);
+		obs_data_set_int(encoder_settings, "bitrate",
+				planned_audio_bitrates[i]);
+		obs_encoder_update(audio_encoders[i], encoder_settings);
+		obs_data_release(encoder_settings);
+		nicolive_log_info("lower audio track %d bitrate: %lld",
+				(int)i, planned_audio_bitrates[i]);
+	}
+
+	encoder_settings = obs_encoder_get_settings(video_encoder);
+	video_bitrate = obs_data_get_int(encoder_settings, "bitrate");
+	if (planned_video_bitrate != video_bitrate) {
+		obs_data_set_int(encoder_settings, "bitrate",
+				planned_video_bitrate);
+		obs_encoder_update(video_encoder, encoder_settings);
 		nicolive_log_debug("adjust bitrate: %lld",
-				bitrate - audio_bitrate);
+				planned_video_bitrate);
 	} else {
 		nicolive_log_debug("need not adjust bitrate");
 	}
+	obs_data_release(encoder_settings);
 
 	return true;
 }
 
+static void auto_tune(obs_output_t *output,
+		const struct nicolive_tuning *tuning)
+{
+	obs_encoder_t *video_encoder = obs_output_get_video_encoder(output);
+	obs_data_t *video_encoder_settings =
+			obs_encoder_get_settings(video_encoder);
+	struct obs_video_info ovi;
+
+	// other encoders have their own presets
+	if (strcmp(obs_encoder_get_id(video_encoder), "obs_x264") == 0)
+		obs_data_set_string(video_encoder_settings, "preset",
+				tuning->preset);
+	obs_data_set_string(video_encoder_settings, "rate_control",
+			tuning->rate_control);
+	obs_encoder_update(video_encoder, video_encoder_settings);
+	obs_data_release(video_encoder_settings);
+
+	if (tuning->height > 0 && obs_get_video_info(&ovi) &&
+			(uint32_t)tuning->height < ovi.output_height) {
+		uint32_t width = (ovi.output_width * tuning->height /
+				ovi.output_height) & ~1u;
+		obs_encoder_set_scaled_size(video_encoder, width,
+				tuning->height);
+		nicolive_log_info("auto tune: %s, %s, %ux%d",
+				tuning->preset, tuning->rate_control,
+				width, tuning->height);
+	} else {
+		obs_encoder_set_scaled_size(video_encoder, 0, 0);
+		nicolive_log_info("auto tune: %s, %s, no scaling",
+				tuning->preset, tuning->rate_control);
+	}
+}
+
 static const char *rtmp_nicolive_getname(void)
 {
 	return obs_module_text("NiconicoLive");
@@ -57,6 +256,18 @@ static const char *rtmp_nicolive_getname(void)
 static void rtmp_nicolive_update_internal(void *data, obs_data_t *settings,
 	bool msg_gui)
 {
+	// the transport and the server first, every web access below must
+	// be recorded, replayed or go to the configured server
+	nicolive_set_traffic(data,
+			(int)obs_data_get_int(settings, "traffic_mode"),
+			obs_data_get_string(settings, "traffic_file"));
+	nicolive_set_api_base_url(data,
+			obs_data_get_string(settings, "api_base_url"));
+	nicolive_publish_set_api(data,
+			(int)obs_data_get_int(settings, "traffic_mode"),
+			obs_data_get_string(settings, "traffic_file"),
+			obs_data_get_string(settings, "api_base_url"));
+
 	switch (obs_data_get_int(settings, "login_type")) {
 	case RTMP_NICOLIVE_LOGIN_MAIL:
 		nicolive_set_settings(data,
@@ -132,6 +343,21 @@ static void rtmp_nicolive_update_internal(void *data, obs_data_t *settings,
 
 	nicolive_set_enabled_adjust_bitrate(data,
 			obs_data_get_bool(settings, "adjust_bitrate"));
+	nicolive_set_enabled_lower_audio(data,
+			obs_data_get_bool(settings, "lower_audio"));
+	nicolive_set_enabled_adaptive_bitrate(data,
+			obs_data_get_bool(settings, "adaptive_bitrate"));
+	nicolive_set_enabled_auto_tune(data,
+			obs_data_get_bool(settings, "auto_tune"));
+	nicolive_set_enabled_bandwidth_probe(data,
+			obs_data_get_bool(settings, "bandwidth_probe"));
+	nicolive_set_enabled_hedge_request(data,
+			obs_data_get_bool(settings, "hedge_request"));
+	if (!nicolive_set_metrics_port(data,
+			(int)obs_data_get_int(settings, "metrics_port")))
+		nicolive_log_warn("failed to start the metrics server");
+	nicolive_publish_set_sessions(data,
+			obs_data_get_string(settings, "extra_sessions"));
 
 	if (obs_data_get_bool(settings, "auto_start")) {
 		nicolive_start_watching(data,
@@ -147,6 +373,16 @@ static void rtmp_nicolive_update_internal(void *data, obs_data_t *settings,
 	// reset_obs_data(string, settings, "session");
 	// reset_obs_data(bool,   settings, "load_viqo");
 	reset_obs_data(bool,   settings, "adjust_bitrate");
+	reset_obs_data(bool,   settings, "lower_audio");
+	reset_obs_data(bool,   settings, "adaptive_bitrate");
+	reset_obs_data(bool,   settings, "auto_tune");
+	reset_obs_data(bool,   settings, "bandwidth_probe");
+	reset_obs_data(bool,   settings, "hedge_request");
+	reset_obs_data(int,    settings, "metrics_port");
+	reset_obs_data(string, settings, "extra_sessions");
+	reset_obs_data(string, settings, "api_base_url");
+	reset_obs_data(int,    settings, "traffic_mode");
+	reset_obs_data(string, settings, "traffic_file");
 	reset_obs_data(bool,   settings, "auto_start");
 	reset_obs_data(int,    settings, "watch_interval");
 }
@@ -167,14 +403,18 @@ static void rtmp_nicolive_update_silent(void *data, obs_data_t *settings)
 
 static void rtmp_nicolive_destroy(void *data)
 {
+	if (session_encoders.owner == data)
+		clear_session_encoders();
+	nicolive_signals_detach(data);
+	nicolive_publish_destroy(data);
 	nicolive_destroy(data);
 }
 
 static void *rtmp_nicolive_create(obs_data_t *settings, obs_service_t *service)
 {
 	void *data = nicolive_create();
-	UNUSED_PARAMETER(service);
 
+	nicolive_signals_attach(data, service);
 	rtmp_nicolive_update_silent(data, settings);
 
 	return data;
@@ -184,6 +424,8 @@ static bool rtmp_nicolive_initialize(void *data, obs_output_t *output)
 {
 	bool success = false;
 	bool msg_gui = !nicolive_silent_once(data);
+	nicolive_trace_begin("initialize");
+	nicolive_set_output(data, output);
 
 	if (nicolive_check_session(data)) {
 		if (nicolive_check_live(data)) {
@@ -201,28 +443,74 @@ static bool rtmp_nicolive_initialize(void *data, obs_output_t *output)
 		success = false;
 	}
 
-	if (success && nicolive_enabled_adjust_bitrate(data)) {
-		if (!adjust_bitrate(output, nicolive_get_live_bitrate(data))) {
+	long long extra_bitrate = 0;
+	if (success) {
+		extra_bitrate = nicolive_publish_prepare(data, output);
+		// before adjust_bitrate and auto_tune change them
+		save_session_encoders(data, output);
+	}
+
+	// the probe and the extra lives can only lower the bitrate through
+	// adjusting it
+	if (success && (nicolive_enabled_adjust_bitrate(data) ||
+			nicolive_enabled_bandwidth_probe(data) ||
+			extra_bitrate > 0)) {
+		long long bitrate = nicolive_get_safe_bitrate(data);
+		// one encode is shared, so it must fit every live
+		if (extra_bitrate > 0 &&
+				(bitrate <= 0 || extra_bitrate < bitrate))
+			bitrate = extra_bitrate;
+		nicolive_trace_begin("adjust_bitrate");
+		// without a cap there is nothing to split
+		if (bitrate > 0)
+			success = adjust_bitrate(output, bitrate,
+					nicolive_enabled_lower_audio(data));
+		else
+			nicolive_log_info("adjust bitrate: skip, "
+					"unknown bitrate");
+		nicolive_trace_end("adjust_bitrate");
+		if (!success) {
 			nicolive_msg_warn(msg_gui,
 					obs_module_text(
 						"MessageFailedAdjustBitrate"),
 					"cannot start streaming: "
 					"failed adjust bitrate");
-			success = false;
 		}
 	}
+
+	if (success && nicolive_enabled_auto_tune(data)) {
+		// the tuning table is by the cap, nothing to tune to without it
+		if (nicolive_get_live_bitrate(data) > 0) {
+			struct nicolive_tuning tuning;
+			nicolive_get_tuning(data, &tuning);
+			auto_tune(output, &tuning);
+		} else {
+			nicolive_log_info("auto tune: skip, unknown bitrate");
+		}
+	}
+	// no deactivate follows a failed initialize
+	if (!success)
+		restore_session_encoders(data);
+	nicolive_trace_end("initialize");
 	return success;
 }
 
 static void rtmp_nicolive_activate(void *data, obs_data_t *settings)
 {
 	UNUSED_PARAMETER(settings);
+	nicolive_trace_begin("activate");
 	nicolive_start_streaming(data);
+	nicolive_publish_start(data);
+	nicolive_trace_end("activate");
 }
 
 static void rtmp_nicolive_deactivate(void *data)
 {
+	nicolive_trace_begin("deactivate");
+	nicolive_publish_stop(data);
 	nicolive_stop_streaming(data);
+	restore_session_encoders(data);
+	nicolive_trace_end("deactivate");
 }
 
 // static bool load_viqo_modified(obs_properties_t *props,
@@ -329,6 +617,46 @@ static obs_properties_t *rtmp_nicolive_properties(void *data)
 	obs_properties_add_bool(ppts, "adjust_bitrate",
 			obs_module_text("AdjustBitrate"));
 
+	obs_properties_add_bool(ppts, "lower_audio",
+			obs_module_text("LowerAudio"));
+
+	obs_properties_add_bool(ppts, "adaptive_bitrate",
+			obs_module_text("AdaptiveBitrate"));
+
+	obs_properties_add_bool(ppts, "auto_tune",
+			obs_module_text("AutoTune"));
+
+	obs_properties_add_bool(ppts, "bandwidth_probe",
+			obs_module_text("BandwidthProbe"));
+
+	obs_properties_add_bool(ppts, "hedge_request",
+			obs_module_text("HedgeRequest"));
+
+	obs_properties_add_int(ppts, "metrics_port",
+			obs_module_text("MetricsPort"),
+			0, 65535, 1);
+
+	obs_properties_add_text(ppts, "extra_sessions",
+			obs_module_text("ExtraSessions"), OBS_TEXT_MULTILINE);
+
+	obs_properties_add_text(ppts, "api_base_url",
+			obs_module_text("ApiBaseUrl"), OBS_TEXT_DEFAULT);
+
+	list = obs_properties_add_list(ppts, "traffic_mode",
+			obs_module_text("TrafficMode"),
+			OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(list, obs_module_text("TrafficOff"),
+			NICOLIVE_TRAFFIC_OFF);
+	obs_property_list_add_int(list, obs_module_text("TrafficRecord"),
+			NICOLIVE_TRAFFIC_RECORD);
+	obs_property_list_add_int(list, obs_module_text("TrafficReplay"),
+			NICOLIVE_TRAFFIC_REPLAY);
+	obs_property_list_add_int(list, obs_module_text("TrafficReplayTimed"),
+			NICOLIVE_TRAFFIC_REPLAY_TIMED);
+	obs_properties_add_path(ppts, "traffic_file",
+			obs_module_text("TrafficFile"),
+			OBS_PATH_FILE_SAVE, "*.log", NULL);
+
 	prop = obs_properties_add_bool(ppts, "auto_start",
 			obs_module_text("AutoStart"));
 	obs_property_set_modified_callback(prop, auto_start_modified);
@@ -348,6 +676,17 @@ static void rtmp_nicolive_defaults(obs_data_t *settings)
 	obs_data_set_default_string(settings, "session",         "");
 	// obs_data_set_default_bool  (settings, "load_viqo",       false);
 	obs_data_set_default_bool  (settings, "adjust_bitrate",  true);
+	obs_data_set_default_bool  (settings, "lower_audio",     false);
+	obs_data_set_default_bool  (settings, "adaptive_bitrate", false);
+	obs_data_set_default_bool  (settings, "auto_tune",       false);
+	obs_data_set_default_bool  (settings, "bandwidth_probe", false);
+	obs_data_set_default_bool  (settings, "hedge_request",   false);
+	obs_data_set_default_int   (settings, "metrics_port",    0);
+	obs_data_set_default_string(settings, "extra_sessions",  "");
+	obs_data_set_default_string(settings, "api_base_url",    "");
+	obs_data_set_default_int   (settings, "traffic_mode",
+			NICOLIVE_TRAFFIC_OFF);
+	obs_data_set_default_string(settings, "traffic_file",    "");
 	obs_data_set_default_bool  (settings, "auto_start",      false);
 	obs_data_set_default_int   (settings, "watch_interval",  60);
 }
@@ -365,7 +704,7 @@ static const char *rtmp_nicolive_key(void *data)
 static bool rtmp_nicolive_supports_multitrack(void *data)
 {
 	UNUSED_PARAMETER(data);
-	return false;
+	return true;
 }
 
 struct obs_service_info rtmp_nicolive_service = {
@@ -393,9 +732,18 @@ OBS_MODULE_AUTHOR("raccy")
 bool obs_module_load(void)
 {
 	obs_register_service(&rtmp_nicolive_service);
+	nicolive_signals_register();
+	nicolive_ui_load();
 	return true;
 }
 
+void obs_module_unload(void)
+{
+	nicolive_ui_unload();
+	nicolive_trace_close();
+	nicolive_log_shutdown();
+}
+
 const char *obs_module_name(void)
 {
 	return obs_module_text("NiconicoLiveModule");
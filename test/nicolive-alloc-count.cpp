@@ -0,0 +1,47 @@
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "nicolive-alloc-count.h"
+
+std::atomic<bool> nicoliveAllocCounting(false);
+std::atomic<long long> nicoliveAllocs(0);
+std::atomic<long long> nicoliveAllocBytes(0);
+std::atomic<long long> nicoliveFrees(0);
+
+void *nicoliveCountedAllocate(std::size_t size)
+{
+	if (nicoliveAllocCounting.load(std::memory_order_relaxed)) {
+		nicoliveAllocs.fetch_add(1, std::memory_order_relaxed);
+		nicoliveAllocBytes.fetch_add(static_cast<long long>(size),
+			std::memory_order_relaxed);
+	}
+	return std::malloc(size > 0 ? size : 1);
+}
+
+void nicoliveCountedDeallocate(void *ptr)
+{
+	if (ptr != nullptr &&
+			nicoliveAllocCounting.load(std::memory_order_relaxed)) {
+		nicoliveFrees.fetch_add(1, std::memory_order_relaxed);
+	}
+	std::free(ptr);
+}
+
+void *operator new(std::size_t size)
+{
+	void *ptr = nicoliveCountedAllocate(size);
+	if (ptr == nullptr) {
+		throw std::bad_alloc();
+	}
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+	nicoliveCountedDeallocate(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	nicoliveCountedDeallocate(ptr);
+}
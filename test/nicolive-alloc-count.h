@@ -0,0 +1,17 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Allocations and frees of operator new and delete, and of the functions
+// below given to pugixml, counted while nicoliveAllocCounting is set.
+// Defined in nicolive-alloc-count.cpp, apart from the code which uses
+// them, so that a new and delete inlined into the same function are not
+// taken as mismatched.
+extern std::atomic<bool> nicoliveAllocCounting;
+extern std::atomic<long long> nicoliveAllocs;
+extern std::atomic<long long> nicoliveAllocBytes;
+extern std::atomic<long long> nicoliveFrees;
+
+void *nicoliveCountedAllocate(std::size_t size);
+void nicoliveCountedDeallocate(void *ptr);
@@ -0,0 +1,239 @@
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <util/base.h>
+#include "nico-live-api.hpp"
+#include "nico-live-memory-transport.hpp"
+#include "pugixml.hpp"
+#include "nicolive-alloc-count.h"
+
+// Micro benchmarks of the web API on recorded responses.
+//
+//   nicolive-bench FIXTURE_DIR [min_msec]
+//
+// The fixtures are responses of tools/standin/nicolive_standin.rb. Each
+// case runs for at least min_msec (200 by default) and is printed as JSON
+// with ns/op, and allocs/op and bytes/op of operator new and pugixml.
+
+struct BenchResult {
+	long long iterations = 0;
+	double nsPerOp = 0.0;
+	double allocsPerOp = 0.0;
+	double bytesPerOp = 0.0;
+};
+
+template <typename Function>
+static BenchResult bench(long long minMsec, Function function)
+{
+	// warm up caches and the reusable buffers
+	function();
+
+	BenchResult result;
+	long long iterations = 1;
+	for (;;) {
+		nicoliveAllocs = 0;
+		nicoliveAllocBytes = 0;
+		nicoliveAllocCounting = true;
+		auto startTime = std::chrono::steady_clock::now();
+		for (long long i = 0; i < iterations; i++) {
+			function();
+		}
+		long long nsec = std::chrono::duration_cast<
+			std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now() - startTime).count();
+		nicoliveAllocCounting = false;
+		if (nsec >= minMsec * 1000000 || iterations >= (1LL << 40)) {
+			result.iterations = iterations;
+			result.nsPerOp = static_cast<double>(nsec) / iterations;
+			result.allocsPerOp =
+				static_cast<double>(nicoliveAllocs) / iterations;
+			result.bytesPerOp =
+				static_cast<double>(nicoliveAllocBytes) / iterations;
+			return result;
+		}
+		iterations *= 2;
+	}
+}
+
+static std::string readFixture(const std::string &dir, const char *name)
+{
+	std::ifstream file(dir + "/" + name, std::ios::binary);
+	if (!file) {
+		std::fprintf(stderr, "cannot read fixture: %s\n", name);
+		std::exit(1);
+	}
+	std::stringstream content;
+	content << file.rdbuf();
+	return content.str();
+}
+
+// as NicoLive::pubStatXpathMap with the status and error of sitePubStat
+static const char *const PUBSTAT_XPATHS[] = {
+	"/getpublishstatus/@status",
+	"/getpublishstatus/error/code/text()",
+	"/getpublishstatus//stream/id/text()",
+	"/getpublishstatus//stream/exclude/text()",
+	"/getpublishstatus//stream/base_time/text()",
+	"/getpublishstatus//stream/open_time/text()",
+	"/getpublishstatus//stream/start_time/text()",
+	"/getpublishstatus//stream/end_time/text()",
+	"/getpublishstatus//rtmp/url/text()",
+	"/getpublishstatus//rtmp/stream/text()",
+	"/getpublishstatus//rtmp/ticket/text()",
+	"/getpublishstatus//rtmp/bitrate/text()",
+	nullptr,
+};
+
+// as NicoLiveApi::loginApiTicket
+static const char *const LOGIN_XPATHS[] = {
+	"/nicovideo_user_response/@status",
+	"/nicovideo_user_response/ticket/text()",
+	nullptr,
+};
+
+static void resetData(
+	std::unordered_map<std::string, std::vector<std::string>> *data,
+	const char *const *xpaths)
+{
+	data->clear();
+	for (auto xpath = xpaths; *xpath != nullptr; xpath++) {
+		(*data)[*xpath];
+	}
+}
+
+static void logHandler(int level, const char *format, va_list args,
+	void *param)
+{
+	(void)param;
+	// keep stdout for the results
+	if (level <= LOG_WARNING) {
+		std::vfprintf(stderr, format, args);
+		std::fputc('\n', stderr);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s FIXTURE_DIR [min_msec]\n",
+			argv[0]);
+		return 2;
+	}
+	const std::string dir = argv[1];
+	long long minMsec = argc > 2 ? std::atoll(argv[2]) : 200;
+	base_set_log_handler(logHandler, nullptr);
+	pugi::set_memory_management_functions(nicoliveCountedAllocate,
+		nicoliveCountedDeallocate);
+
+	const std::string pubStatXml =
+		readFixture(dir, "getpublishstatus.xml");
+	const std::string pubStatHeader =
+		readFixture(dir, "getpublishstatus_header.txt");
+	const std::string loginXml = readFixture(dir, "login_api.xml");
+	const std::string loginHeader =
+		readFixture(dir, "login_site_header.txt");
+
+	const std::string text =
+		"test@example.com & p=a+s%s w\x7f\xe3\x81\x82";
+	std::unordered_map<std::string, std::string> formData = {
+		{"mail", "test@example.com"},
+		{"password", "p@ss w&rd"},
+		{"site", "nicolive_encoder"},
+	};
+	std::unordered_map<std::string, std::string> cookie = {
+		{"user_session", "user_session_1_46604f2f"},
+		{"nicosid", "1500000000.1234567890"},
+	};
+	std::unordered_map<std::string, std::vector<std::string>> data;
+	std::string sink;
+	volatile size_t sinkSize = 0;
+
+	NicoLiveApi api;
+	NicoLiveMemoryTransport *transport = new NicoLiveMemoryTransport();
+	NicoLiveMemoryTransport::Entry entry;
+	// without the status line
+	entry.header = pubStatHeader.substr(pubStatHeader.find('\n') + 1);
+	entry.body = pubStatXml;
+	transport->setResponse(NicoLiveApi::PUBSTAT_URL, entry);
+	api.setTransport(transport);
+	api.setCookie("user_session", "user_session_1_46604f2f");
+
+	struct Case {
+		const char *name;
+		BenchResult result;
+	};
+	std::vector<Case> cases;
+
+	cases.push_back({"urlEncode", bench(minMsec, [&]() {
+		sink = NicoLiveApi::urlEncode(text);
+	})});
+	cases.push_back({"createWwwFormUrlencoded", bench(minMsec, [&]() {
+		sink = NicoLiveApi::createWwwFormUrlencoded(formData);
+	})});
+	cases.push_back({"createCookieString", bench(minMsec, [&]() {
+		sink = NicoLiveApi::createCookieString(cookie);
+	})});
+	cases.push_back({"parseXml/pubstat", bench(minMsec, [&]() {
+		resetData(&data, PUBSTAT_XPATHS);
+		NicoLiveApi::parseXml(pubStatXml, &data);
+	})});
+	cases.push_back({"parseXml/login", bench(minMsec, [&]() {
+		resetData(&data, LOGIN_XPATHS);
+		NicoLiveApi::parseXml(loginXml, &data);
+	})});
+	cases.push_back({"headerValue", bench(minMsec, [&]() {
+		// every line as accessWeb looks for its headers
+		static const char *const names[] = {
+			"Set-Cookie", "Content-Length", "Cache-Control",
+			"ETag", "Last-Modified", nullptr,
+		};
+		size_t lineBegin = 0;
+		while (lineBegin < loginHeader.size()) {
+			size_t lineEnd = loginHeader.find('\n', lineBegin);
+			if (lineEnd == std::string::npos) {
+				lineEnd = loginHeader.size();
+			}
+			for (auto name = names; *name != nullptr; name++) {
+				size_t begin;
+				size_t end;
+				if (NicoLiveApi::headerValue(
+						loginHeader.c_str() + lineBegin,
+						lineEnd - lineBegin, *name,
+						&begin, &end)) {
+					sinkSize += end - begin;
+				}
+			}
+			lineBegin = lineEnd + 1;
+		}
+	})});
+	cases.push_back({"getPublishStatus", bench(minMsec, [&]() {
+		resetData(&data, PUBSTAT_XPATHS);
+		api.getPublishStatus(&data);
+	})});
+
+	if (data["/getpublishstatus/@status"].empty() ||
+			data["/getpublishstatus/@status"][0] != "ok") {
+		std::fprintf(stderr, "publish status not decoded\n");
+		return 1;
+	}
+
+	std::printf("{\"min_msec\": %lld, \"benchmarks\": [\n", minMsec);
+	for (size_t i = 0; i < cases.size(); i++) {
+		const BenchResult &result = cases[i].result;
+		std::printf("  {\"name\": \"%s\", \"iterations\": %lld, "
+			"\"ns_per_op\": %.1f, \"allocs_per_op\": %.2f, "
+			"\"bytes_per_op\": %.1f}%s\n",
+			cases[i].name, result.iterations, result.nsPerOp,
+			result.allocsPerOp, result.bytesPerOp,
+			i + 1 < cases.size() ? "," : "");
+	}
+	std::printf("]}\n");
+	return 0;
+}
@@ -0,0 +1,135 @@
+#include <vector>
+#include "nico-live-bitrate-budget.hpp"
+#include "nicolive-test.h"
+
+// NicoLiveBitrateBudget::plan, which nicolive_plan_bitrate wraps for
+// adjust_bitrate, over a matrix of caps and audio track layouts.
+
+typedef NicoLiveBitrateBudget Budget;
+
+static bool isAacStep(long long kbps)
+{
+	static const long long steps[] = {
+		48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 288, 320,
+	};
+	for (long long step: steps) {
+		if (kbps == step) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static long long sum(const std::vector<long long> &kbps)
+{
+	long long total = 0;
+	for (long long value: kbps) {
+		total += value;
+	}
+	return total;
+}
+
+// what holds for every cap and layout
+static void checkInvariants(long long cap,
+	const std::vector<long long> &audio, bool lowerAudio)
+{
+	Budget::Plan plan = Budget::plan(cap, audio, lowerAudio);
+	NICOLIVE_CHECK(plan.audioKbps.size() == audio.size());
+	if (plan.audioKbps.size() != audio.size()) {
+		return;
+	}
+	NICOLIVE_CHECK(plan.videoKbps == cap - sum(plan.audioKbps));
+	NICOLIVE_CHECK(plan.ok == (plan.videoKbps >= Budget::VIDEO_MIN_KBPS));
+
+	bool lowered = false;
+	bool atMin = true;
+	for (size_t i = 0; i < audio.size(); i++) {
+		NICOLIVE_CHECK(plan.audioKbps[i] <= audio[i]);
+		if (plan.audioKbps[i] != audio[i]) {
+			lowered = true;
+			NICOLIVE_CHECK(isAacStep(plan.audioKbps[i]));
+			NICOLIVE_CHECK(plan.audioKbps[i] >=
+				Budget::AUDIO_MIN_KBPS);
+		}
+		if (plan.audioKbps[i] > Budget::AUDIO_MIN_KBPS) {
+			atMin = false;
+		}
+	}
+	if (!lowerAudio || cap - sum(audio) >= Budget::VIDEO_FLOOR_KBPS) {
+		// nothing to lower
+		NICOLIVE_CHECK(!lowered);
+	} else {
+		// lowered until the video reaches the floor or no audio is left
+		NICOLIVE_CHECK(plan.videoKbps >= Budget::VIDEO_FLOOR_KBPS ||
+			atMin);
+	}
+}
+
+static void testMatrix()
+{
+	const long long caps[] = {
+		0, 150, 200, 300, 480, 600, 1000, 2000, 6000,
+	};
+	const std::vector<std::vector<long long>> layouts = {
+		{},
+		{128},
+		{48},
+		{128, 128},
+		{320, 160, 64},
+		{48, 48},
+		{96, 96, 96, 96, 96, 96},
+		{100}, // not an AAC step
+	};
+	for (long long cap: caps) {
+		for (auto &audio: layouts) {
+			checkInvariants(cap, audio, false);
+			checkInvariants(cap, audio, true);
+		}
+	}
+}
+
+static void testPlans()
+{
+	// fits without lowering
+	Budget::Plan plan = Budget::plan(2000, {128}, true);
+	NICOLIVE_CHECK(plan.ok && plan.videoKbps == 1872);
+	NICOLIVE_CHECK(plan.audioKbps == std::vector<long long>({128}));
+
+	// no audio tracks, the video gets the cap
+	plan = Budget::plan(300, {}, true);
+	NICOLIVE_CHECK(plan.ok && plan.videoKbps == 300);
+	plan = Budget::plan(150, {}, true);
+	NICOLIVE_CHECK(!plan.ok);
+
+	// the largest track steps down first, alternating between equals
+	plan = Budget::plan(600, {128, 128}, true);
+	NICOLIVE_CHECK(plan.ok && plan.videoKbps == 408);
+	NICOLIVE_CHECK(plan.audioKbps == std::vector<long long>({96, 96}));
+	plan = Budget::plan(600, {128, 128}, false);
+	NICOLIVE_CHECK(plan.ok && plan.videoKbps == 344);
+
+	plan = Budget::plan(800, {320, 160, 64}, true);
+	NICOLIVE_CHECK(plan.ok && plan.videoKbps == 416);
+	NICOLIVE_CHECK(plan.audioKbps ==
+		std::vector<long long>({160, 160, 64}));
+
+	// a track off the AAC steps goes down through the steps below it
+	plan = Budget::plan(480, {100}, true);
+	NICOLIVE_CHECK(plan.ok && plan.audioKbps[0] == 80);
+
+	// under the minimum even with every track at 48 kbps
+	plan = Budget::plan(200, {128, 128}, true);
+	NICOLIVE_CHECK(!plan.ok);
+	NICOLIVE_CHECK(plan.audioKbps == std::vector<long long>({48, 48}));
+
+	// no cap
+	plan = Budget::plan(0, {128}, true);
+	NICOLIVE_CHECK(!plan.ok);
+}
+
+int main()
+{
+	testMatrix();
+	testPlans();
+	return nicolive_test_result();
+}
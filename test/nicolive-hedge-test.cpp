@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nico-live-api.hpp"
+#include "nico-live-histogram.hpp"
+
+// Poll the publish status of a stand-in server with hedged requests off and
+// on, and compare the tail latencies.
+//
+//   nicolive-hedge-test BASE_URL [requests]
+//
+// Prints the latencies as JSON and fails unless hedging lowers the p99.
+
+struct Latencies {
+	std::vector<long long> usecs;
+	NicoLiveHistogram histogram;
+	long long failures = 0;
+};
+
+// nearest rank
+static long long percentileUsec(const std::vector<long long> &sorted,
+	int percentile)
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t rank = (sorted.size() * percentile + 99) / 100;
+	return sorted[std::max(rank, static_cast<size_t>(1)) - 1];
+}
+
+static Latencies poll(NicoLiveApi *api, int requests)
+{
+	Latencies latencies;
+	std::unordered_map<std::string, std::vector<std::string>> data;
+	for (int i = 0; i < requests; i++) {
+		data.clear();
+		data["/getpublishstatus/@status"];
+		auto startTime = std::chrono::steady_clock::now();
+		bool result = api->getPublishStatus(&data);
+		long long usec = std::chrono::duration_cast<
+			std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - startTime).count();
+		if (!result) {
+			latencies.failures++;
+			continue;
+		}
+		latencies.usecs.push_back(usec);
+		latencies.histogram.add(usec);
+	}
+	std::sort(latencies.usecs.begin(), latencies.usecs.end());
+	return latencies;
+}
+
+static void printLatencies(const char *name, const Latencies &latencies,
+	bool last)
+{
+	const std::vector<long long> &usecs = latencies.usecs;
+	std::printf("  \"%s\": {\"requests\": %zu, \"failures\": %lld, "
+		"\"p50_ms\": %.1f, \"p90_ms\": %.1f, \"p99_ms\": %.1f, "
+		"\"max_ms\": %.1f,\n    \"histogram_ms\": {",
+		name, usecs.size(), latencies.failures,
+		percentileUsec(usecs, 50) / 1000.0,
+		percentileUsec(usecs, 90) / 1000.0,
+		percentileUsec(usecs, 99) / 1000.0,
+		usecs.empty() ? 0.0 : usecs.back() / 1000.0);
+	for (int i = 0; i < NicoLiveHistogram::BUCKETS; i++) {
+		long long upper = NicoLiveHistogram::upperMsec(i);
+		std::printf("%s\"%s\": %lld", i > 0 ? ", " : "",
+			upper < 0 ? "+Inf" : std::to_string(upper).c_str(),
+			latencies.histogram.counts[i]);
+	}
+	std::printf("}}%s\n", last ? "" : ",");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s BASE_URL [requests]\n",
+			argv[0]);
+		return 2;
+	}
+	int requests = argc > 2 ? std::atoi(argv[2]) : 400;
+
+	NicoLiveApi api;
+	api.setBaseUrl(argv[1]);
+	if (!api.loginSiteNicolive("test@example.com", "password")) {
+		std::fprintf(stderr, "cannot login to %s\n", argv[1]);
+		return 1;
+	}
+
+	api.setEnabledHedge(false);
+	Latencies off = poll(&api, requests);
+	api.setEnabledHedge(true);
+	Latencies on = poll(&api, requests);
+
+	std::printf("{\n");
+	printLatencies("hedge_off", off, false);
+	printLatencies("hedge_on", on, true);
+	std::printf("}\n");
+
+	long long p99Off = percentileUsec(off.usecs, 99);
+	long long p99On = percentileUsec(on.usecs, 99);
+	if (off.failures > 0 || on.failures > 0 || p99On >= p99Off) {
+		std::fprintf(stderr, "hedge did not lower p99: %lld -> %lld us\n",
+			p99Off, p99On);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,93 @@
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <QtCore>
+#include "nico-live.hpp"
+#include "nicolive-ui.h"
+
+// Measure how late streaming starts for a live and restarts for the next
+// one, against a stand-in server with test/fixtures/latency_schedule.json.
+//
+//   nicolive-latency-test BASE_URL
+//
+// The watcher polls every MIN_INTERVAL_SEC. A lag is from the start time
+// of a live, in whole seconds as the publish status has it, to the call
+// which starts its streaming. Prints the lags as JSON and fails unless
+// both lives are streamed within MAX_LAG_SEC.
+
+static const int WATCH_SEC = 10;
+static const int MAX_LAG_SEC = 25;
+static const int TIMEOUT_SEC = 90;
+
+static NicoLive *latencyNicolive = nullptr;
+static std::vector<double> startLags;
+static std::vector<double> transitionLags;
+
+static double liveLag()
+{
+	return latencyNicolive->getLiveStartTime().msecsTo(
+		QDateTime::currentDateTime()) / 1000.0;
+}
+
+// instead of nicolive-ui.cpp, which goes through OBS
+extern "C" void nicolive_streaming_start(void)
+{
+	startLags.push_back(liveLag());
+	latencyNicolive->startStreaming();
+}
+
+extern "C" void nicolive_streaming_stop(void)
+{
+	latencyNicolive->stopStreaming();
+	// the last live has ended
+	QCoreApplication::quit();
+}
+
+extern "C" void nicolive_streaming_restart(void)
+{
+	transitionLags.push_back(liveLag());
+	latencyNicolive->stopStreaming();
+	latencyNicolive->startStreaming();
+}
+
+static void printLags(const char *name, const std::vector<double> &lags,
+	bool last)
+{
+	std::printf("  \"%s\": [", name);
+	for (size_t i = 0; i < lags.size(); i++) {
+		std::printf("%s%.3f", i > 0 ? ", " : "", lags[i]);
+	}
+	std::printf("]%s\n", last ? "" : ",");
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	if (argc < 2) {
+		std::fprintf(stderr, "usage: %s BASE_URL\n", argv[0]);
+		return 2;
+	}
+
+	NicoLive nicolive;
+	latencyNicolive = &nicolive;
+	nicolive.setApiBaseUrl(argv[1]);
+	nicolive.setAccount("test@example.com", "password");
+	nicolive.startWatching(WATCH_SEC);
+	QTimer::singleShot(TIMEOUT_SEC * 1000, &app, SLOT(quit()));
+	app.exec();
+	nicolive.stopWatching();
+
+	std::printf("{\"watch_sec\": %d,\n", WATCH_SEC);
+	printLags("start_lag_sec", startLags, false);
+	printLags("transition_lag_sec", transitionLags, true);
+	std::printf("}\n");
+
+	bool ok = startLags.size() == 1 && transitionLags.size() == 1;
+	for (double lag: startLags) {
+		ok = ok && lag <= MAX_LAG_SEC;
+	}
+	for (double lag: transitionLags) {
+		ok = ok && lag <= MAX_LAG_SEC;
+	}
+	return ok ? 0 : 1;
+}
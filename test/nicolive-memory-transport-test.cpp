@@ -0,0 +1,115 @@
+#include <atomic>
+#include <string>
+#include "nico-live-memory-transport.hpp"
+#include "nicolive-test.h"
+
+// NicoLiveMemoryTransport, which the benchmarks and the soak harness
+// serve their responses with.
+
+static const std::string URL = "http://127.0.0.1/api/getpublishstatus";
+
+static NicoLiveTransport::Result perform(NicoLiveMemoryTransport *transport,
+	const std::string &url, NicoLiveResponse *response,
+	NicoLiveMetrics *metrics)
+{
+	NicoLiveRequest request;
+	request.url = url;
+	request.timeoutMsec = 1000;
+	return transport->perform(request, response, metrics);
+}
+
+static void testResponses()
+{
+	NicoLiveMemoryTransport transport;
+	NicoLiveResponse response;
+	NicoLiveMetrics metrics;
+	NicoLiveMemoryTransport::Entry fixed;
+	fixed.header = "Content-Type: text/xml\r\n";
+	fixed.body = "fixed";
+	transport.setResponse(URL, fixed);
+	NicoLiveMemoryTransport::Entry queued;
+	queued.code = 503;
+	queued.body = "queued";
+	transport.pushResponse(URL, queued);
+
+	// the queued one once, then the fixed one
+	NICOLIVE_CHECK(perform(&transport, URL, &response, &metrics) ==
+		NicoLiveTransport::Result::OK);
+	NICOLIVE_CHECK(response.code == 503 && response.body == "queued");
+	NICOLIVE_CHECK(perform(&transport, URL, &response, &metrics) ==
+		NicoLiveTransport::Result::OK);
+	NICOLIVE_CHECK(response.code == 200 && response.body == "fixed");
+	NICOLIVE_CHECK(response.header ==
+		"HTTP/1.1 200\r\nContent-Type: text/xml\r\n\r\n");
+
+	// the query string is ignored without a response for the full url
+	NICOLIVE_CHECK(perform(&transport, URL + "?ticket=1", &response,
+		&metrics) == NicoLiveTransport::Result::OK);
+	NICOLIVE_CHECK(response.body == "fixed");
+	NICOLIVE_CHECK(perform(&transport, "http://127.0.0.1/other",
+		&response, &metrics) == NicoLiveTransport::Result::OK);
+	NICOLIVE_CHECK(response.code == 404);
+
+	NICOLIVE_CHECK(transport.requestCount(URL) == 2);
+	NICOLIVE_CHECK(transport.requestCount(URL + "?ticket=1") == 1);
+	NICOLIVE_CHECK(metrics.requests == 4);
+	transport.clear();
+	NICOLIVE_CHECK(transport.requestCount(URL) == 0);
+}
+
+static void testCompletion()
+{
+	NicoLiveMemoryTransport transport;
+	NicoLiveResponse response;
+	NicoLiveMetrics metrics;
+	NicoLiveMemoryTransport::Entry entry;
+	entry.body = "<a></a><b></b>";
+	transport.setResponse(URL, entry);
+
+	NicoLiveRequest request;
+	request.url = URL;
+	request.timeoutMsec = 1000;
+	request.completeBody = [](const std::string &body) {
+		size_t end = body.find("</a>");
+		return end == std::string::npos ? 0 : end + 4;
+	};
+	NICOLIVE_CHECK(transport.perform(request, &response, &metrics) ==
+		NicoLiveTransport::Result::OK);
+	NICOLIVE_CHECK(response.body == "<a></a>");
+	NICOLIVE_CHECK(metrics.earlyCompletions == 1);
+}
+
+static void testLatency()
+{
+	NicoLiveMemoryTransport transport;
+	NicoLiveResponse response;
+	NicoLiveMetrics metrics;
+	NicoLiveMemoryTransport::Entry entry;
+	entry.latencyMsec = 200;
+	transport.setResponse(URL, entry);
+
+	NicoLiveRequest request;
+	request.url = URL;
+	request.timeoutMsec = 50;
+	NICOLIVE_CHECK(transport.perform(request, &response, &metrics) ==
+		NicoLiveTransport::Result::TIMEOUT);
+
+	std::atomic<bool> canceled(true);
+	request.timeoutMsec = 1000;
+	request.canceled = &canceled;
+	NICOLIVE_CHECK(transport.perform(request, &response, &metrics) ==
+		NicoLiveTransport::Result::CANCELED);
+
+	canceled = false;
+	NICOLIVE_CHECK(transport.perform(request, &response, &metrics) ==
+		NicoLiveTransport::Result::OK);
+	NICOLIVE_CHECK(response.timing.totalUsec >= 200 * 1000);
+}
+
+int main()
+{
+	testResponses();
+	testCompletion();
+	testLatency();
+	return nicolive_test_result();
+}
@@ -0,0 +1,134 @@
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nico-live-api.hpp"
+#include "nico-live-memory-transport.hpp"
+#include "nicolive-alloc-count.h"
+#include "nicolive-test.h"
+#include "pugixml.hpp"
+
+// A poll of an unchanged publish status, as the watcher does every few
+// seconds for hours, does not allocate once the buffers have grown.
+
+static const int POLLS = 100;
+
+static const std::string STATUS_XPATH = "/getpublishstatus/@status";
+static const std::string ID_XPATH = "/getpublishstatus/stream/id/text()";
+
+static std::string publishStatus(const std::string &id)
+{
+	return "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+		"<getpublishstatus status=\"ok\" time=\"1500000000\">"
+		"<stream><id>" + id + "</id>"
+		"<token>0123456789abcdef0123456789abcdef</token>"
+		"<exclude>0</exclude>"
+		"<base_time>1500000000</base_time>"
+		"<open_time>1500000000</open_time>"
+		"<start_time>1500000600</start_time>"
+		"<end_time>1500002400</end_time>"
+		"</stream>"
+		"<rtmp is_fms=\"1\" rtmpt_port=\"80\">"
+		"<url>rtmp://127.0.0.1:1935/publicorigin/" + id + "</url>"
+		"<stream>" + id + "</stream>"
+		"<ticket>ticket_0123456789abcdef</ticket>"
+		"<bitrate>1000</bitrate>"
+		"</rtmp>"
+		"</getpublishstatus>";
+}
+
+static void resetData(
+	std::unordered_map<std::string, std::vector<std::string>> *data)
+{
+	(*data)[STATUS_XPATH].clear();
+	(*data)[ID_XPATH].clear();
+}
+
+// allocations of polls after the warm-up ones
+static long long countPollAllocs(NicoLiveApi *api, const std::string *ticket,
+	std::unordered_map<std::string, std::vector<std::string>> *data)
+{
+	bool ok = true;
+	bool changed = false;
+	auto poll = [&]() {
+		resetData(data);
+		bool result = ticket != nullptr ?
+			api->getPublishStatusTicket(*ticket, data, &changed) :
+			api->getPublishStatus(data, &changed);
+		ok = ok && result;
+	};
+	// the first poll parses, the second one grows the other buffer
+	poll();
+	NICOLIVE_CHECK(ok && changed);
+	NICOLIVE_CHECK(!(*data)[ID_XPATH].empty());
+	poll();
+	poll();
+
+	nicoliveAllocs = 0;
+	nicoliveAllocCounting = true;
+	for (int i = 0; i < POLLS; i++) {
+		poll();
+		if (!ok || changed) {
+			break;
+		}
+	}
+	nicoliveAllocCounting = false;
+	NICOLIVE_CHECK(ok && !changed);
+	return nicoliveAllocs;
+}
+
+static void testPoll(const std::string &header, bool useTicket)
+{
+	NicoLiveApi api;
+	NicoLiveMemoryTransport *transport = new NicoLiveMemoryTransport();
+	NicoLiveMemoryTransport::Entry entry;
+	entry.header = header;
+	entry.body = publishStatus("lv100");
+	transport->setResponse(NicoLiveApi::PUBSTAT_URL, entry);
+	api.setTransport(transport);
+	api.setCookie("user_session", "user_session_1_46604f2f");
+	api.setCookie("nicosid", "1500000000.1234567890");
+
+	std::unordered_map<std::string, std::vector<std::string>> data;
+	const std::string ticket = "nicolive_encoder_ticket_0123456789";
+	long long allocs = countPollAllocs(&api,
+		useTicket ? &ticket : nullptr, &data);
+	if (allocs != 0) {
+		std::fprintf(stderr, "%lld allocations in %d %s polls\n",
+			allocs, POLLS, useTicket ? "ticket" : "session");
+	}
+	NICOLIVE_CHECK(allocs == 0);
+
+	// a changed status is still parsed, once a fresh one has expired
+	entry.body = publishStatus("lv200");
+	transport->setResponse(NicoLiveApi::PUBSTAT_URL, entry);
+	api.clearCache();
+	bool changed = false;
+	resetData(&data);
+	NICOLIVE_CHECK(useTicket ?
+		api.getPublishStatusTicket(ticket, &data, &changed) :
+		api.getPublishStatus(&data, &changed));
+	NICOLIVE_CHECK(changed);
+	NICOLIVE_CHECK(!data[ID_XPATH].empty() && data[ID_XPATH][0] == "lv200");
+}
+
+int main()
+{
+	pugi::set_memory_management_functions(nicoliveCountedAllocate,
+		nicoliveCountedDeallocate);
+
+	static const char *const headers[] = {
+		"Content-Type: text/xml\r\nContent-Length: 757\r\n",
+		// stored in the cache and revalidated by every poll
+		"Content-Type: text/xml\r\n"
+			"ETag: \"5f3a1c2e-0123456789abcdef\"\r\n"
+			"Last-Modified: Fri, 14 Jul 2017 02:40:00 GMT\r\n"
+			"Cache-Control: private, no-cache\r\n",
+		// served from the cache without access
+		"Content-Type: text/xml\r\nCache-Control: Max-Age=60\r\n",
+	};
+	for (const char *header: headers) {
+		testPoll(header, false);
+		testPoll(header, true);
+	}
+	return nicolive_test_result();
+}
@@ -0,0 +1,101 @@
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "nico-live-api.hpp"
+#include "nico-live-record-transport.hpp"
+#include "nicolive-test.h"
+
+// Record a login and publish status polls against a stand-in server, then
+// replay them without network.
+//
+//   nicolive-record-replay-test BASE_URL TRAFFIC_PATH
+
+static const char *const MAIL = "test@example.com";
+static const char *const PASSWORD = "password";
+static const std::string STATUS_XPATH = "/getpublishstatus/@status";
+static const std::string ID_XPATH = "/getpublishstatus/stream/id/text()";
+
+static void checkPublishStatus(NicoLiveApi *api, const std::string &ticket)
+{
+	std::unordered_map<std::string, std::vector<std::string>> data;
+	data[STATUS_XPATH];
+	data[ID_XPATH];
+	if (ticket.empty()) {
+		NICOLIVE_CHECK(api->getPublishStatus(&data));
+	} else {
+		NICOLIVE_CHECK(api->getPublishStatusTicket(ticket, &data));
+	}
+	NICOLIVE_CHECK(data[STATUS_XPATH].size() == 1 &&
+		data[STATUS_XPATH][0] == "ok");
+	NICOLIVE_CHECK(data[ID_XPATH].size() == 1 &&
+		data[ID_XPATH][0] == "lv1");
+}
+
+static void testRedactHeader()
+{
+	NICOLIVE_CHECK(NicoLiveRecordTransport::redactHeader(
+		"HTTP/1.1 302 Found\r\n"
+		"Set-Cookie: user_session=user_session_1_ab12; path=/\r\n"
+		"Location: /\r\n\r\n") ==
+		"HTTP/1.1 302 Found\r\n"
+		"Set-Cookie: user_session=user_session_REDACTED; path=/\r\n"
+		"Location: /\r\n\r\n");
+	NICOLIVE_CHECK(NicoLiveRecordTransport::redactHeader(
+		"Set-Cookie: other=1\r\n") ==
+		"Set-Cookie: other=other_REDACTED\r\n");
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 3) {
+		std::fprintf(stderr, "usage: %s BASE_URL TRAFFIC_PATH\n",
+			argv[0]);
+		return 2;
+	}
+	const std::string baseUrl = argv[1];
+	const std::string path = argv[2];
+
+	testRedactHeader();
+
+	std::string session;
+	std::string ticket;
+	{
+		NicoLiveApi api;
+		api.setBaseUrl(baseUrl);
+		api.setTraffic(NicoLiveApi::TrafficMode::RECORD, path);
+		NICOLIVE_CHECK(api.loginSiteNicolive(MAIL, PASSWORD));
+		session = api.getCookie("user_session");
+		checkPublishStatus(&api, std::string());
+		ticket = api.loginNicoliveEncoder(MAIL, PASSWORD);
+		NICOLIVE_CHECK(!ticket.empty());
+		checkPublishStatus(&api, ticket);
+	}
+
+	std::ifstream file(path, std::ios::binary);
+	std::stringstream log;
+	log << file.rdbuf();
+	NICOLIVE_CHECK(!session.empty() &&
+		log.str().find(session) == std::string::npos);
+	NICOLIVE_CHECK(!ticket.empty() &&
+		log.str().find(ticket) == std::string::npos);
+	NICOLIVE_CHECK(log.str().find(std::string("password=") + PASSWORD) ==
+		std::string::npos);
+
+	{
+		NicoLiveApi api;
+		api.setBaseUrl(baseUrl);
+		api.setTraffic(NicoLiveApi::TrafficMode::REPLAY, path);
+		NICOLIVE_CHECK(api.loginSiteNicolive(MAIL, PASSWORD));
+		NICOLIVE_CHECK(api.getCookie("user_session") ==
+			"user_session_REDACTED");
+		checkPublishStatus(&api, std::string());
+		std::string replayedTicket =
+			api.loginNicoliveEncoder(MAIL, PASSWORD);
+		NICOLIVE_CHECK(replayedTicket ==
+			NicoLiveRecordTransport::REDACTED);
+		checkPublishStatus(&api, replayedTicket);
+	}
+	return nicolive_test_result();
+}
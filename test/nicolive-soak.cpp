@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <QtCore>
+#include <util/base.h>
+#include <util/platform.h>
+#include "nico-live.hpp"
+#include "nico-live-api.hpp"
+#include "nico-live-memory-transport.hpp"
+#include "nico-live-virtual-clock.hpp"
+#include "nicolive-ui.h"
+#include "nicolive-alloc-count.h"
+
+// Watch days of lives in simulated time.
+//
+//   nicolive-soak [days]
+//
+// NicoLive runs on a NicoLiveVirtualClock and polls a
+// NicoLiveMemoryTransport, which serves the publish status of a generated
+// schedule: chains of back-to-back 30 minute lives with gaps between them.
+// The streaming of the watcher goes to NicoLive directly. After a day of
+// warm up, the growth of the resident size, allocations not freed and
+// QObjects are measured. Prints the results as JSON and fails if a live
+// was not streamed.
+
+static const qint64 LIVE_MSEC = 30 * 60 * 1000;
+static const qint64 DAY_MSEC = 24 * 60 * 60 * 1000;
+
+struct Live {
+	QString id;
+	qint64 openMsec;
+	qint64 endMsec;
+	// since the open, -1 until streamed
+	qint64 lagMsec = -1;
+};
+
+static NicoLiveVirtualClock *soakClock = nullptr;
+static NicoLive *soakNicolive = nullptr;
+static std::vector<Live> soakLives;
+static long long soakStarts = 0;
+static long long soakRestarts = 0;
+static long long soakStops = 0;
+
+static void recordStart()
+{
+	qint64 now = soakClock->elapsed();
+	for (auto &live: soakLives) {
+		if (live.id == soakNicolive->getLiveId() &&
+				live.lagMsec < 0) {
+			live.lagMsec = now - live.openMsec;
+		}
+	}
+}
+
+// instead of nicolive-ui.cpp, which goes through OBS
+extern "C" void nicolive_streaming_start(void)
+{
+	soakStarts++;
+	soakNicolive->startStreaming();
+	recordStart();
+}
+
+extern "C" void nicolive_streaming_stop(void)
+{
+	soakStops++;
+	soakNicolive->stopStreaming();
+}
+
+extern "C" void nicolive_streaming_restart(void)
+{
+	soakRestarts++;
+	soakNicolive->stopStreaming();
+	soakNicolive->startStreaming();
+	recordStart();
+}
+
+// chains of one to three lives with gaps of 5 minutes to 3 hours, all
+// ending before durationMsec
+static std::vector<Live> createSchedule(qint64 durationMsec)
+{
+	std::vector<Live> lives;
+	unsigned random = 1;
+	qint64 msec = 10 * 60 * 1000;
+	for (;;) {
+		random = random * 1103515245 + 12345;
+		int chain = 1 + (random >> 16) % 3;
+		if (msec + chain * LIVE_MSEC > durationMsec) {
+			break;
+		}
+		for (int i = 0; i < chain; i++) {
+			Live live;
+			live.id = QString("lv%1").arg(lives.size() + 1);
+			live.openMsec = msec;
+			live.endMsec = msec + LIVE_MSEC;
+			lives.push_back(live);
+			msec = live.endMsec;
+		}
+		random = random * 1103515245 + 12345;
+		msec += (5 + (random >> 16) % 176) * 60 * 1000;
+	}
+	return lives;
+}
+
+// as tools/standin/nicolive_standin.rb
+static std::string publishStatus(const Live *live, qint64 epochSec)
+{
+	std::string xml = "<?xml version=\"1.0\" encoding=\"utf-8\"?>";
+	if (live == nullptr) {
+		return xml + "<getpublishstatus status=\"fail\">"
+			"<error><code>notfound</code></error>"
+			"</getpublishstatus>";
+	}
+	std::string id = live->id.toStdString();
+	std::string open = std::to_string(epochSec + live->openMsec / 1000);
+	std::string end = std::to_string(epochSec + live->endMsec / 1000);
+	return xml + "<getpublishstatus status=\"ok\"><stream>"
+		"<id>" + id + "</id><exclude>0</exclude>"
+		"<base_time>" + open + "</base_time>"
+		"<open_time>" + open + "</open_time>"
+		"<start_time>" + open + "</start_time>"
+		"<end_time>" + end + "</end_time></stream>"
+		"<rtmp is_fms=\"1\"><url>rtmp://127.0.0.1/live/" + id +
+		"</url><stream>" + id + "</stream>"
+		"<ticket>" + id + "_ticket</ticket>"
+		"<bitrate>2000</bitrate></rtmp></getpublishstatus>";
+}
+
+// msec to the nearest rank of the percentile of the streamed lives
+static qint64 lagPercentile(std::vector<qint64> sorted, int percentile)
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+	size_t rank = (sorted.size() * percentile + 99) / 100;
+	return sorted[std::max(rank, static_cast<size_t>(1)) - 1];
+}
+
+static void logHandler(int level, const char *format, va_list args,
+	void *param)
+{
+	(void)param;
+	// keep stdout for the results
+	if (level <= LOG_WARNING) {
+		std::vfprintf(stderr, format, args);
+		std::fputc('\n', stderr);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	int days = argc > 1 ? std::atoi(argv[1]) : 7;
+	if (days < 2) {
+		days = 2;
+	}
+	base_set_log_handler(logHandler, nullptr);
+
+	const QDateTime epoch = QDateTime::fromMSecsSinceEpoch(
+		1500000000LL * 1000);
+	const qint64 epochSec = epoch.toMSecsSinceEpoch() / 1000;
+	NicoLiveVirtualClock clock(epoch);
+	soakClock = &clock;
+	soakLives = createSchedule(days * DAY_MSEC - 10 * 60 * 1000);
+
+	NicoLive *nicolive = new NicoLive(nullptr, &clock);
+	soakNicolive = nicolive;
+	NicoLiveMemoryTransport *transport = new NicoLiveMemoryTransport();
+	nicolive->setTransport(transport);
+	nicolive->setSession("user_session_soak");
+
+	// the publish status changes only at the open and end of lives
+	std::vector<qint64> changes;
+	for (auto &live: soakLives) {
+		changes.push_back(live.openMsec);
+		changes.push_back(live.endMsec);
+	}
+	changes.push_back(DAY_MSEC);
+	changes.push_back(days * DAY_MSEC);
+	std::sort(changes.begin(), changes.end());
+	changes.erase(std::unique(changes.begin(), changes.end()),
+		changes.end());
+
+	long long startResident = 0;
+	int startObjects = 0;
+	bool watching = false;
+	for (qint64 change: changes) {
+		const Live *current = nullptr;
+		for (auto &live: soakLives) {
+			if (live.openMsec <= clock.elapsed() &&
+					clock.elapsed() < live.endMsec) {
+				current = &live;
+			}
+		}
+		NicoLiveMemoryTransport::Entry entry;
+		entry.header = "Content-Type: text/xml\r\n";
+		entry.body = publishStatus(current, epochSec);
+		transport->setResponse(NicoLiveApi::PUBSTAT_URL, entry);
+		if (!watching) {
+			nicolive->startWatching(60);
+			watching = true;
+		}
+		if (clock.elapsed() == DAY_MSEC) {
+			// after a day of warm up
+			startResident = static_cast<long long>(
+				os_get_proc_resident_size());
+			startObjects = nicolive->findChildren<QObject *>()
+				.size();
+			nicoliveAllocs = 0;
+			nicoliveFrees = 0;
+			nicoliveAllocCounting = true;
+		}
+		clock.advance(change - clock.elapsed());
+	}
+	nicoliveAllocCounting = false;
+	long long unfreedAllocs = nicoliveAllocs - nicoliveFrees;
+	long long endResident = static_cast<long long>(
+		os_get_proc_resident_size());
+	int endObjects = nicolive->findChildren<QObject *>().size();
+	nicolive->stopWatching();
+
+	std::vector<qint64> lags;
+	long long missed = 0;
+	for (auto &live: soakLives) {
+		if (live.lagMsec >= 0) {
+			lags.push_back(live.lagMsec);
+		} else {
+			missed++;
+		}
+	}
+	std::sort(lags.begin(), lags.end());
+
+	std::printf("{\"days\": %d, \"lives\": %zu, \"missed\": %lld,\n",
+		days, soakLives.size(), missed);
+	std::printf("  \"streaming\": {\"starts\": %lld, \"restarts\": %lld, "
+		"\"stops\": %lld},\n", soakStarts, soakRestarts, soakStops);
+	std::printf("  \"requests\": {\"pubstat\": %lld, \"changed\": %lld, "
+		"\"unchanged\": %lld, \"failed\": %lld, \"login\": %lld},\n",
+		transport->requestCount(NicoLiveApi::PUBSTAT_URL),
+		nicolive->getPubStatChangedCount(),
+		nicolive->getPubStatUnchangedCount(),
+		nicolive->getPubStatFailedCount(),
+		nicolive->getLoginAttemptCount());
+	std::printf("  \"lag_sec\": {\"p50\": %.1f, \"p90\": %.1f, "
+		"\"p99\": %.1f, \"max\": %.1f},\n",
+		lagPercentile(lags, 50) / 1000.0,
+		lagPercentile(lags, 90) / 1000.0,
+		lagPercentile(lags, 99) / 1000.0,
+		lags.empty() ? 0.0 : lags.back() / 1000.0);
+	std::printf("  \"after_warm_up\": {\"resident_growth_bytes\": %lld, "
+		"\"unfreed_allocs\": %lld, \"qobject_growth\": %d}}\n",
+		endResident - startResident, unfreedAllocs,
+		endObjects - startObjects);
+
+	delete nicolive;
+	return missed > 0 ? 1 : 0;
+}
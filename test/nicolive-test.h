@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdio>
+
+// Checks of the tests, which go on after a failure and report the count.
+inline int &nicolive_test_failures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+#define NICOLIVE_CHECK(expr) \
+	do { \
+		if (!(expr)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", \
+				__FILE__, __LINE__, #expr); \
+			nicolive_test_failures()++; \
+		} \
+	} while (0)
+
+// exit status of main
+inline int nicolive_test_result()
+{
+	if (nicolive_test_failures() > 0) {
+		std::fprintf(stderr, "%d checks failed\n",
+			nicolive_test_failures());
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,44 @@
+#!/usr/bin/ruby
+# coding: utf-8
+
+# Run a command against a stand-in server on a free loopback port.
+#
+#   ruby run_with_standin.rb nicolive_standin.rb [stand-in options]
+#     -- command [args]
+#
+# @BASE_URL@ in args is replaced with the url of the stand-in. The exit
+# status is that of the command.
+
+require 'socket'
+
+standin, *args = ARGV
+separator = args.index('--')
+abort 'usage: run_with_standin.rb standin.rb [options] -- command' \
+  if standin.nil? || separator.nil?
+options = args[0...separator]
+command = args[(separator + 1)..-1]
+
+probe = TCPServer.new('127.0.0.1', 0)
+port = probe.addr[1]
+probe.close
+base_url = "http://127.0.0.1:#{port}"
+
+server = Process.spawn(RbConfig.ruby, standin, '--port', port.to_s,
+                       *options)
+begin
+  deadline = Time.now + 10
+  begin
+    TCPSocket.new('127.0.0.1', port).close
+  rescue SystemCallError
+    abort 'stand-in did not start' if Time.now > deadline
+    sleep 0.1
+    retry
+  end
+  pid = Process.spawn(*command.map { |arg| arg.gsub('@BASE_URL@', base_url) })
+  Process.wait(pid)
+  status = $?.exitstatus || 1
+ensure
+  Process.kill('TERM', server) rescue nil
+  Process.wait(server) rescue nil
+end
+exit status
@@ -18,6 +18,10 @@ find_path(OBS_INCLUDES_LIBOBS
 	NAMES obs.h obs-module.h
 	PATHS "${OBS_SRC}/libobs")
 
+find_path(OBS_INCLUDES_FRONTEND_API
+	NAMES obs-frontend-api.h
+	PATHS "${OBS_SRC}/UI/obs-frontend-api")
+
 if(CMAKE_SIZEOF_VOID_P EQUAL 8)
 	set(_lib_suffix 64)
 else()
@@ -32,9 +36,11 @@ if(MSVC)
 
 	set(OBS_APP_BIN "${OBS_APP}/bin/${_lib_suffix}bit")
 	set(OBS_LIB_LIBOBS "${OBS_APP_BIN}/obs.dll")
+	set(OBS_LIB_FRONTEND_API "${OBS_APP_BIN}/obs-frontend-api.dll")
 	# win lib
 	set(OBS_APP_LIB "${CMAKE_CURRENT_SOURCE_DIR}/build/lib${_lib_suffix}")
 	set(OBS_LIB_LIBOBS_LIB "${OBS_APP_LIB}/obs.lib")
+	set(OBS_LIB_FRONTEND_API_LIB "${OBS_APP_LIB}/obs-frontend-api.lib")
 elseif(APPLE)
 	set(LIBOBS_PLUGIN_DESTINATION
 		"${OBS_APP}/Contents/Resources/obs-plugins/")
@@ -43,6 +49,7 @@ elseif(APPLE)
 
 	set(OBS_APP_BIN "${OBS_APP}/Contents/Resources/bin")
 	set(OBS_LIB_LIBOBS "${OBS_APP_BIN}/libobs.0.dylib")
+	set(OBS_LIB_FRONTEND_API "${OBS_APP_BIN}/libobs-frontend-api.dylib")
 else()
 	# linux?
 	set(LIBOBS_PLUGIN_DESTINATION
@@ -52,4 +59,5 @@ else()
 
 	set(OBS_APP_BIN "${OBS_APP}/lib")
 	set(OBS_LIB_LIBOBS "${OBS_APP_BIN}/libobs.0.so")
+	set(OBS_LIB_FRONTEND_API "${OBS_APP_BIN}/libobs-frontend-api.so")
 endif()
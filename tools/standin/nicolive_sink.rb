@@ -0,0 +1,97 @@
+#!/usr/bin/ruby
+# coding: utf-8
+
+# TCP sink for the upload bandwidth probe of rtmp-nicolive.
+#
+#   ruby nicolive_sink.rb [--port 1935] [--rate-kbps KBPS] [--raw]
+#
+# Reads everything it receives, at most KBPS kilobits per second, which
+# shapes the upload of the client. Without --raw it answers the RTMP
+# handshake first. The receive rate of each connection is logged.
+
+require 'socket'
+
+class NicoliveSink
+  HANDSHAKE_SIZE = 1536
+  READ_SIZE = 4096
+  RECEIVE_BUFFER_SIZE = 64 * 1024
+
+  def initialize(options)
+    @options = options
+    @start_time = Time.now
+  end
+
+  def run
+    server = TCPServer.new(@options[:bind], @options[:port])
+    # a small buffer, so the reads shape the sender
+    server.setsockopt(Socket::SOL_SOCKET, Socket::SO_RCVBUF,
+                      RECEIVE_BUFFER_SIZE)
+    log "listen on #{@options[:bind]}:#{@options[:port]}, " \
+        "rate #{@options[:rate_kbps]} kbps"
+    loop do
+      Thread.new(server.accept) do |socket|
+        begin
+          serve(socket)
+        rescue IOError, SystemCallError
+        ensure
+          socket.close rescue nil
+        end
+      end
+    end
+  end
+
+  private
+
+  def log(message)
+    $stderr.puts format('[%8.3f] %s', Time.now - @start_time, message)
+  end
+
+  def handshake(socket)
+    c0c1 = socket.read(1 + HANDSHAKE_SIZE)
+    return false if c0c1.nil? || c0c1.bytesize < 1 + HANDSHAKE_SIZE
+    s1 = [0, 0].pack('NN') + Random.new.bytes(HANDSHAKE_SIZE - 8)
+    socket.write("\x03".b + s1 + c0c1.byteslice(1, HANDSHAKE_SIZE))
+    c2 = socket.read(HANDSHAKE_SIZE)
+    !c2.nil? && c2.bytesize == HANDSHAKE_SIZE
+  end
+
+  def serve(socket)
+    peer = socket.peeraddr.values_at(3, 1).join(':')
+    if !@options[:raw] && !handshake(socket)
+      log "#{peer}: handshake failed"
+      return
+    end
+    started = Time.now
+    received = 0
+    rate = @options[:rate_kbps] * 1000 / 8.0
+    loop do
+      data = socket.readpartial(READ_SIZE)
+      received += data.bytesize
+      next if rate <= 0
+      ahead = received / rate - (Time.now - started)
+      sleep ahead if ahead > 0
+    end
+  rescue EOFError
+  ensure
+    elapsed = Time.now - started if started
+    if elapsed && elapsed > 0
+      log format('%s: %d bytes in %.2fs, %d kbps', peer, received,
+                 elapsed, received * 8 / elapsed / 1000)
+    end
+  end
+end
+
+if __FILE__ == $0
+  options = {bind: '127.0.0.1', port: 1935, rate_kbps: 0, raw: false}
+  args = ARGV.dup
+  until args.empty?
+    arg = args.shift
+    case arg
+    when '--bind' then options[:bind] = args.shift
+    when '--port' then options[:port] = args.shift.to_i
+    when '--rate-kbps' then options[:rate_kbps] = args.shift.to_i
+    when '--raw' then options[:raw] = true
+    end
+  end
+  NicoliveSink.new(options).run
+end
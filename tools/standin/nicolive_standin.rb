@@ -0,0 +1,284 @@
+#!/usr/bin/ruby
+# coding: utf-8
+
+# Stand-in for the nicovideo.jp endpoints used by rtmp-nicolive.
+#
+#   ruby nicolive_standin.rb [schedule.json] [--port 8080]
+#     [--latency MSEC] [--jitter MSEC] [--error-rate RATE]
+#     [--straggler-rate RATE --straggler-msec MSEC]
+#     [--cert cert.pem --key key.pem]
+#
+# Set "http://127.0.0.1:8080" to the web API server setting of the plugin.
+# Each frame of the schedule opens, starts and ends at seconds after the
+# server start. The delay from the start of a frame to the first status
+# request which reports it is logged as its transition latency.
+# A straggler is a request delayed by --straggler-msec more than the others,
+# as a server with a long tail does.
+
+require 'json'
+require 'openssl'
+require 'socket'
+require 'time'
+require 'uri'
+
+class NicoliveStandin
+  DEFAULT_SCHEDULE = {
+    'mail' => 'test@example.com',
+    'password' => 'password',
+    'bitrate' => 2000,
+    'rtmp_url' => 'rtmp://127.0.0.1/live',
+    'frames' => [
+      {'id' => 'lv1', 'open' => 0, 'start' => 10, 'end' => 70},
+      {'id' => 'lv2', 'open' => 70, 'start' => 70, 'end' => 130},
+    ],
+  }
+
+  def initialize(schedule, options)
+    @schedule = schedule
+    @options = options
+    @start_time = Time.now
+    @sessions = {}
+    @tickets = {}
+    @first_seen = {}
+    @mutex = Mutex.new
+    @counter = 0
+  end
+
+  def run
+    server = TCPServer.new(@options[:bind], @options[:port])
+    if @options[:cert]
+      context = OpenSSL::SSL::SSLContext.new
+      context.cert = OpenSSL::X509::Certificate.new(
+        File.read(@options[:cert]))
+      context.key = OpenSSL::PKey.read(File.read(@options[:key]))
+      server = OpenSSL::SSL::SSLServer.new(server, context)
+    end
+    log "listen on #{@options[:bind]}:#{@options[:port]}"
+    loop do
+      begin
+        client = server.accept
+      rescue OpenSSL::SSL::SSLError => e
+        log "tls error: #{e.message}"
+        next
+      end
+      Thread.new(client) do |socket|
+        begin
+          serve(socket)
+        rescue IOError, SystemCallError, OpenSSL::SSL::SSLError
+        ensure
+          socket.close rescue nil
+        end
+      end
+    end
+  end
+
+  private
+
+  def log(message)
+    $stderr.puts format('[%8.3f] %s', Time.now - @start_time, message)
+  end
+
+  def now_offset
+    Time.now - @start_time
+  end
+
+  # keep-alive until the client closes
+  def serve(socket)
+    loop do
+      request_line = socket.gets
+      return if request_line.nil?
+      method, target, = request_line.split(' ')
+      headers = {}
+      while (line = socket.gets) && line != "\r\n" && line != "\n"
+        name, value = line.split(':', 2)
+        headers[name.strip.downcase] = value.to_s.strip
+      end
+      body = socket.read(headers['content-length'].to_i).to_s
+      uri = URI.parse(target)
+      params = URI.decode_www_form(uri.query.to_s).to_h
+      params.merge!(URI.decode_www_form(body).to_h) if method == 'POST'
+
+      inject_latency
+      if inject_error?
+        log "inject error: #{method} #{uri.path}"
+        if rand < 0.5
+          return
+        end
+        respond(socket, 503, {}, 'Service Unavailable')
+        next
+      end
+
+      case uri.path
+      when '/secure/login'
+        login_site(socket, params)
+      when '/api/v1/login'
+        login_api(socket, params)
+      when '/api/getpublishstatus'
+        publish_status(socket, params, cookies(headers['cookie']))
+      else
+        respond(socket, 404, {}, 'Not Found')
+      end
+    end
+  end
+
+  def inject_latency
+    latency = @options[:latency] + rand(0..@options[:jitter])
+    if @options[:straggler_rate] > 0 && rand < @options[:straggler_rate]
+      latency += @options[:straggler_msec]
+    end
+    sleep(latency / 1000.0) if latency > 0
+  end
+
+  def inject_error?
+    @options[:error_rate] > 0 && rand < @options[:error_rate]
+  end
+
+  def cookies(header)
+    header.to_s.split(';').map { |pair| pair.strip.split('=', 2) }
+      .select { |pair| pair.size == 2 }.to_h
+  end
+
+  def respond(socket, code, headers, body)
+    reason = {200 => 'OK', 302 => 'Found', 404 => 'Not Found',
+              503 => 'Service Unavailable'}[code]
+    response = "HTTP/1.1 #{code} #{reason}\r\n"
+    headers.each { |name, value| response << "#{name}: #{value}\r\n" }
+    response << "Content-Length: #{body.bytesize}\r\n"
+    response << "\r\n"
+    response << body
+    socket.write(response)
+  end
+
+  def authorized?(params)
+    params['mail'] == @schedule['mail'] &&
+      params['password'] == @schedule['password']
+  end
+
+  def next_token(prefix)
+    @mutex.synchronize do
+      @counter += 1
+      "#{prefix}#{@counter}_#{rand(1 << 32).to_s(16)}"
+    end
+  end
+
+  def login_site(socket, params)
+    headers = {'Location' => '/'}
+    if authorized?(params)
+      session = next_token('user_session_')
+      @mutex.synchronize { @sessions[session] = true }
+      headers['Set-Cookie'] = "user_session=#{session}; path=/"
+      log "login site: ok"
+    else
+      log "login site: fail"
+    end
+    respond(socket, 302, headers, '')
+  end
+
+  def login_api(socket, params)
+    if authorized?(params)
+      ticket = next_token('nicolive_encoder_')
+      @mutex.synchronize { @tickets[ticket] = true }
+      log "login api: ok"
+      body = '<?xml version="1.0" encoding="utf-8"?>' \
+        '<nicovideo_user_response status="ok">' \
+        "<ticket>#{ticket}</ticket></nicovideo_user_response>"
+    else
+      log "login api: fail"
+      body = '<?xml version="1.0" encoding="utf-8"?>' \
+        '<nicovideo_user_response status="fail">' \
+        '<error><code>1</code></error></nicovideo_user_response>'
+    end
+    respond(socket, 200, {'Content-Type' => 'text/xml'}, body)
+  end
+
+  def current_frame
+    offset = now_offset
+    @schedule['frames'].find do |frame|
+      frame['open'] <= offset && offset < frame['end']
+    end
+  end
+
+  def publish_status(socket, params, cookie)
+    valid = @mutex.synchronize do
+      @sessions[cookie['user_session']] || @tickets[params['ticket']]
+    end
+    frame = current_frame
+    if !valid
+      body = status_fail('unknown')
+    elsif frame.nil?
+      body = status_fail('notfound')
+    else
+      record_first_seen(frame)
+      body = status_ok(frame)
+    end
+    respond(socket, 200, {'Content-Type' => 'text/xml'}, body)
+  end
+
+  def record_first_seen(frame)
+    @mutex.synchronize do
+      key = frame['id']
+      return if @first_seen[key]
+      @first_seen[key] = now_offset
+      latency = [now_offset - frame['start'], now_offset - frame['open']]
+      log format('frame %s: first reported %.3f s after open, ' \
+        '%.3f s after start', key, latency[1], latency[0])
+    end
+  end
+
+  def status_fail(code)
+    '<?xml version="1.0" encoding="utf-8"?>' \
+      '<getpublishstatus status="fail" time="' + Time.now.to_i.to_s + '">' \
+      "<error><code>#{code}</code></error></getpublishstatus>"
+  end
+
+  def status_ok(frame)
+    base = @start_time.to_i
+    '<?xml version="1.0" encoding="utf-8"?>' \
+      '<getpublishstatus status="ok" time="' + Time.now.to_i.to_s + '">' \
+      '<stream>' \
+      "<id>#{frame['id']}</id>" \
+      "<token>#{frame['id']}_token</token>" \
+      "<exclude>#{frame['exclude'] || 0}</exclude>" \
+      "<provider_type>community</provider_type>" \
+      "<base_time>#{base + frame['open']}</base_time>" \
+      "<open_time>#{base + frame['open']}</open_time>" \
+      "<start_time>#{base + frame['start']}</start_time>" \
+      "<end_time>#{base + frame['end']}</end_time>" \
+      '<allow_vote>0</allow_vote><disable_adaptive_bitrate>1' \
+      '</disable_adaptive_bitrate><is_reserved>0</is_reserved>' \
+      "<for_mobile>0</for_mobile><editstream_language>0" \
+      "</editstream_language></stream>" \
+      '<user><nickname>standin</nickname><is_premium>1</is_premium>' \
+      '<user_id>1</user_id><NLE>1</NLE></user>' \
+      '<rtmp is_fms="1">' \
+      "<url>#{@schedule['rtmp_url']}/#{frame['id']}</url>" \
+      "<stream>#{frame['id']}</stream>" \
+      "<ticket>#{frame['id']}_ticket</ticket>" \
+      "<bitrate>#{frame['bitrate'] || @schedule['bitrate']}</bitrate>" \
+      '</rtmp></getpublishstatus>'
+  end
+end
+
+if __FILE__ == $0
+  options = {bind: '127.0.0.1', port: 8080, latency: 0, jitter: 0,
+             error_rate: 0.0, straggler_rate: 0.0, straggler_msec: 2000}
+  schedule = NicoliveStandin::DEFAULT_SCHEDULE
+  args = ARGV.dup
+  until args.empty?
+    arg = args.shift
+    case arg
+    when '--bind' then options[:bind] = args.shift
+    when '--port' then options[:port] = args.shift.to_i
+    when '--latency' then options[:latency] = args.shift.to_i
+    when '--jitter' then options[:jitter] = args.shift.to_i
+    when '--error-rate' then options[:error_rate] = args.shift.to_f
+    when '--straggler-rate' then options[:straggler_rate] = args.shift.to_f
+    when '--straggler-msec' then options[:straggler_msec] = args.shift.to_i
+    when '--cert' then options[:cert] = args.shift
+    when '--key' then options[:key] = args.shift
+    else
+      schedule = NicoliveStandin::DEFAULT_SCHEDULE.merge(JSON.parse(File.read(arg)))
+    end
+  end
+  NicoliveStandin.new(schedule, options).run
+end